@@ -4,5 +4,8 @@ package top.lizhistudio.annotation
 @Retention(AnnotationRetention.SOURCE)
 annotation class LuaClass(
   val alias: String = "",
-  val autoRegister: Boolean = false
+  val autoRegister: Boolean = false,
+  //descriptor tables read at runtime instead of a C function per member, meant to trade call speed for
+  //library size and load time, the difference has not been measured
+  val compact: Boolean = false
 )
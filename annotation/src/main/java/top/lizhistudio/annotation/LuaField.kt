@@ -6,5 +6,7 @@ annotation class LuaField(
   val alias: String = "",
   val readonly: Boolean = false,
   val method2field: Boolean = false,
-  val unpack:Array<String> = []
+  val unpack:Array<String> = [],
+  //cache the value in the lua object after the first read, only for readonly fields and getters
+  val cached: Boolean = false
 )
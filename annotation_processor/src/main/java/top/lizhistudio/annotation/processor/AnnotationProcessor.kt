@@ -9,10 +9,14 @@ import top.lizhistudio.annotation.processor.ClassElementMetaData.Companion.toCom
 import top.lizhistudio.annotation.processor.GenerateUtil.isKotlinObject
 import top.lizhistudio.annotation.processor.GenerateUtil.isStaticFunction
 import top.lizhistudio.annotation.processor.GenerateUtil.mIndent
+import top.lizhistudio.annotation.processor.data.CommonField
+import top.lizhistudio.annotation.processor.data.CommonMethod
 import javax.annotation.processing.AbstractProcessor
+import javax.annotation.processing.ProcessingEnvironment
 import javax.annotation.processing.Processor
 import javax.annotation.processing.RoundEnvironment
 import javax.annotation.processing.SupportedAnnotationTypes
+import javax.annotation.processing.SupportedOptions
 import javax.annotation.processing.SupportedSourceVersion
 import javax.lang.model.SourceVersion
 import javax.lang.model.element.ElementKind
@@ -27,15 +31,42 @@ import javax.tools.StandardLocation
   "top.lizhistudio.annotation.LuaEnum",
   "top.lizhistudio.annotation.LuaFunction",
   "top.lizhistudio.annotation.LuaEnvironment")
+@SupportedOptions(AnnotationProcessor.OPTION_STATS)
 class AnnotationProcessor: AbstractProcessor() {
   private val generators = mutableListOf<Generator>()
+  private val callbacks = mutableSetOf<String>()
+
+  override fun init(processingEnv: ProcessingEnvironment) {
+    super.init(processingEnv)
+    GenerateUtil.statsEnabled = processingEnv.options[OPTION_STATS] == "true"
+    GenerateUtil.enumTypes.clear()
+  }
+
+  private fun collectCallbacks(methods:List<CommonMethod>,fields:List<CommonField> = emptyList()){
+    (methods.flatMap { method -> method.parameters.map { it.type } } + fields.map { it.type })
+      .mapNotNull { it.callback }
+      .filter { callbacks.add(it.proxyClassName()) }
+      .forEach {
+        val generator = CallbackCodeGenerator(it)
+        generators.add(generator)
+        processingEnv.filer.createSourceFile(generator.className()).openWriter().use { writer ->
+          writer.write(generator.javaCode())
+        }
+      }
+  }
+
   private fun insertFunction(element:ExecutableElement){
     println("insertFunction ${element.simpleName}  enclosing ${element.enclosingElement.simpleName}")
     val enclosing = element.enclosingElement as TypeElement
     val name = enclosing.qualifiedName.toString()
     val old = generators.firstOrNull {it.className() == name}
     val method = toCommonMethodWithLuaFunction(element)
-    if(old != null){
+    collectCallbacks(listOf(method))
+    if(old is CompactClassCodeGenerator && !old.accepts(method)){
+      val generator = old.toClassCodeGenerator()
+      generators[generators.indexOf(old)] = generator
+      generator.putFunction(method)
+    }else if(old != null){
       (old as FunctionContainer).putFunction(method)
     }else{
       val generator = FunctionsCodeGenerator(enclosing)
@@ -44,16 +75,22 @@ class AnnotationProcessor: AbstractProcessor() {
     }
   }
   override fun process(p0: MutableSet<out TypeElement>?, p1: RoundEnvironment?): Boolean {
+    //enums go first so the class generators know which types are passed by constant name
+    p1?.getElementsAnnotatedWith(LuaEnum::class.java)?.forEach {
+      it as TypeElement
+      if(it.kind == ElementKind.ENUM) GenerateUtil.enumTypes.add(GenerateUtil.getJvmName(it))
+      generators.add(EnumCodeGenerator(it))
+    }
 
     p1?.getElementsAnnotatedWith(LuaClass::class.java)?.forEach {
-      val generator = ClassCodeGenerator(ClassElementMetaData(it as TypeElement))
+      val metaData = ClassElementMetaData(it as TypeElement)
+      collectCallbacks(metaData.methods() + metaData.constructors(),metaData.fields())
+      val generator = if(metaData.compact() && CompactClassCodeGenerator.supports(metaData))
+        CompactClassCodeGenerator(metaData)
+      else
+        ClassCodeGenerator(metaData)
       generators.add(generator)
     }
-    p1?.getElementsAnnotatedWith(LuaEnum::class.java)?.forEach {
-      val generator = EnumCodeGenerator(it as TypeElement)
-      generators.add(generator)
-    }
-
     p1?.getElementsAnnotatedWith(LuaFunction::class.java)?.filter {
       it.kind == ElementKind.METHOD &&
               it is ExecutableElement &&
@@ -203,6 +240,8 @@ class AnnotationProcessor: AbstractProcessor() {
 
   companion object{
     const val TAG = "AnnotationProcessor"
+    //kapt { arguments { arg("luajni.stats", "true") } } makes the generated bindings record call counts and latency
+    const val OPTION_STATS = "luajni.stats"
 
 
 
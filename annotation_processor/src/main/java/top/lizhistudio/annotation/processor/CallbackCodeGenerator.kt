@@ -0,0 +1,281 @@
+package top.lizhistudio.annotation.processor
+
+import top.lizhistudio.annotation.processor.GenerateUtil.generateArrayElementTypeCode
+import top.lizhistudio.annotation.processor.GenerateUtil.jniParameterType
+import top.lizhistudio.annotation.processor.GenerateUtil.mIndent
+import top.lizhistudio.annotation.processor.GenerateUtil.newCallbackFunctionName
+import top.lizhistudio.annotation.processor.GenerateUtil.toJniTypeName
+import top.lizhistudio.annotation.processor.data.CommonCallback
+import top.lizhistudio.annotation.processor.data.CommonType
+
+class CallbackCodeGenerator(private val callback:CommonCallback): CommonGenerator() {
+  private val returnsUnit = callback.returnType == CommonType(UNIT)
+  private val nativeReturnType = if(returnsUnit) CommonType("void") else callback.returnType
+
+  override fun className(): String {
+    return callback.proxyClassName()
+  }
+
+  override fun headerCode(): String {
+    val defineH = "${fileName()}_h".uppercase()
+    return """
+      |#ifndef $defineH
+      |#define $defineH
+      |#ifdef __cplusplus
+      |extern "C" {
+      |#endif
+      |#include<jni.h>
+      |#include "lua.h"
+      |jobject ${newCallbackFunctionName(callback)}(lua_State*L,JNIEnv*env,int index);
+      |int register_${injectToLuaMethodName()}(JNIEnv*env);
+      |int unregister_${injectToLuaMethodName()}(JNIEnv*env);
+      |#ifdef __cplusplus
+      |}
+      |#endif
+      |
+      |#endif //$defineH
+    """.trimMargin()
+  }
+
+  override fun sourceCode(): String {
+    return """
+      |#include "${fileName()}.h"
+      |#include "lua.h"
+      |#include "lauxlib.h"
+      |#include "luajni.h"
+      |#include <stdlib.h>
+      |
+      |typedef struct ClassInfo{
+      |  const char* name;
+      |  int64_t id;
+      |  jmethodID constructor;
+      |}ClassInfo;
+      |
+      |static ClassInfo* classInfo = NULL;
+      |
+      |${callCode()}
+      |
+      |${newCallbackCode()}
+      |
+      |${registerCode()}
+      |
+      |${unregisterCode()}
+    """.trimMargin()
+  }
+
+  fun javaCode(): String {
+    val simpleName = className().substring(className().lastIndexOf('.') + 1)
+    val typeArguments = if(callback.typeArguments.isEmpty()) "" else
+      callback.typeArguments.joinToString(", ", "<", ">")
+    val parameterList = callback.parameters.withIndex().map { (index,type) ->
+      "${javaTypeName(type)} p$index"
+    }
+    val parameters = parameterList.joinToString(", ")
+    val nativeParameters = (listOf("long nativePtr") + parameterList).joinToString(", ")
+    val arguments = (listOf("nativePtr") + callback.parameters.indices.map { "p$it" }).joinToString(", ")
+    val body = when {
+      returnsUnit -> "call($arguments);\nreturn kotlin.Unit.INSTANCE;"
+      nativeReturnType.name == "void" -> "call($arguments);"
+      else -> "return call($arguments);"
+    }
+    return """
+      |package ${CommonCallback.PROXY_PACKAGE};
+      |
+      |public final class $simpleName extends top.lizhistudio.luajni.core.LuaCallback
+      |    implements ${callback.sourceName}$typeArguments {
+      |  public $simpleName(long nativePtr) {
+      |    super(nativePtr);
+      |  }
+      |
+      |  @Override
+      |  public ${javaTypeName(callback.returnType)} ${callback.methodName}($parameters) {
+      |    checkOpen();
+      |${body.mIndent(4)}
+      |  }
+      |
+      |  private static native ${javaTypeName(nativeReturnType)} call($nativeParameters);
+      |}
+    """.trimMargin()
+  }
+
+  private fun callSignature():String{
+    return "(J${callback.parameters.joinToString("") { jniParameterType(it) }})${jniParameterType(nativeReturnType)}"
+  }
+
+  private fun callCode():String{
+    val parameters = callback.parameters.withIndex().joinToString("") { (index,type) ->
+      ",${jniTypeName(type)} p_$index"
+    }
+    val returnJniType = jniTypeName(nativeReturnType)
+    val isVoid = returnJniType == "void"
+    val pushCode = callback.parameters.withIndex().joinToString("\n") { (index,type) ->
+      pushParameterCode(type,"p_$index")
+    }
+    return """
+      |static $returnJniType JNICALL callback_call(JNIEnv* env,jclass clazz,jlong nativePtr$parameters){
+      |  ${if(isVoid) "" else "$returnJniType result = 0;"}
+      |  JNIEnv* savedEnv = NULL;
+      |  lua_State* L = luaJniCallbackEnter(env,(LuaJniCallback*)nativePtr,&savedEnv);
+      |  if(L == NULL) return${if(isVoid) "" else " result"};
+      |  int top = lua_gettop(L) - 1;
+      |${pushCode.mIndent(2)}
+      |  if(luaJniCallbackCall(L,env,${callback.parameters.size},${if(isVoid) 0 else 1})){
+      |${if(isVoid) "" else returnCode(nativeReturnType).mIndent(4)}
+      |  }
+      |  luaJniCallbackLeave(L,savedEnv,top);
+      |  return${if(isVoid) "" else " result"};
+      |}
+    """.trimMargin()
+  }
+
+  private fun pushParameterCode(type:CommonType,name:String):String{
+    val failCode = """
+      |luaJniThrowLuaError(env,lua_tostring(L,-1));
+      |luaJniCallbackLeave(L,savedEnv,top);
+      |return${if(jniTypeName(nativeReturnType) == "void") "" else " result"};
+    """.trimMargin()
+    if(type.dimensions > 0){
+      return """
+        |if($name == NULL){
+        |  lua_pushnil(L);
+        |}else{
+        |  luaJniPushArray(L,env,$name,${type.dimensions},"${type.name}",${generateArrayElementTypeCode(type.name)});
+        |}
+      """.trimMargin()
+    }
+    val wrapperCode = { javaType:String,luaType:String ->
+      """
+        |if($name == NULL){
+        |  lua_pushnil(L);
+        |}else{
+        |  lua_push$luaType(L,luaJni${javaType}Value(env,$name));
+        |}
+      """.trimMargin()
+    }
+    return when(type.name){
+      "boolean" -> "lua_pushboolean(L,$name);"
+      "byte","char","short","int","long" -> "lua_pushinteger(L,$name);"
+      "float","double" -> "lua_pushnumber(L,$name);"
+      "java.lang.String" -> """
+        |if($name == NULL){
+        |  lua_pushnil(L);
+        |}else{
+        |  const char* str_$name = (*env)->GetStringUTFChars(env,$name,NULL);
+        |  lua_pushstring(L,str_$name);
+        |  (*env)->ReleaseStringUTFChars(env,$name,str_$name);
+        |}
+      """.trimMargin()
+      "java.lang.Boolean" -> wrapperCode("Boolean","boolean")
+      "java.lang.Byte" -> wrapperCode("Byte","integer")
+      "java.lang.Character" -> wrapperCode("Char","integer")
+      "java.lang.Short" -> wrapperCode("Short","integer")
+      "java.lang.Integer" -> wrapperCode("Int","integer")
+      "java.lang.Long" -> wrapperCode("Long","integer")
+      "java.lang.Float" -> wrapperCode("Float","number")
+      "java.lang.Double" -> wrapperCode("Double","number")
+      else -> """
+        |if(!luaJniPushObject(L,env,$name,"${type.name}")){
+        |${failCode.mIndent(2)}
+        |}
+      """.trimMargin()
+    }
+  }
+
+  private fun returnCode(type:CommonType):String{
+    val userdataCode = { metaName:String,userdataType:String ->
+      """
+        |$userdataType* userdata = ($userdataType*)luaL_testudata(L,-1,"$metaName");
+        |if(userdata != NULL){
+        |  result = (*env)->NewLocalRef(env,luaJniTakeObject(env,userdata->id));
+        |}
+      """.trimMargin()
+    }
+    if(type.dimensions > 0) return userdataCode("JavaArray","JavaArray")
+    val wrapperCode = { javaType:String,luaType:String,cType:String ->
+      """
+        |if(lua_is$luaType(L,-1)){
+        |  result = luaJniNew$javaType(env,($cType)lua_to$luaType(L,-1));
+        |}
+      """.trimMargin()
+    }
+    return when(type.name){
+      "boolean" -> "result = lua_toboolean(L,-1);"
+      "byte","char","short","int","long" -> "result = (${toJniTypeName(type.name)})lua_tointeger(L,-1);"
+      "float","double" -> "result = (${toJniTypeName(type.name)})lua_tonumber(L,-1);"
+      "java.lang.String" -> """
+        |if(lua_isstring(L,-1)){
+        |  result = (*env)->NewStringUTF(env,lua_tostring(L,-1));
+        |}
+      """.trimMargin()
+      "java.lang.Boolean" -> wrapperCode("Boolean","boolean","jboolean")
+      "java.lang.Byte" -> wrapperCode("Byte","integer","jbyte")
+      "java.lang.Character" -> wrapperCode("Char","integer","jchar")
+      "java.lang.Short" -> wrapperCode("Short","integer","jshort")
+      "java.lang.Integer" -> wrapperCode("Int","integer","jint")
+      "java.lang.Long" -> wrapperCode("Long","integer","jlong")
+      "java.lang.Float" -> wrapperCode("Float","number","jfloat")
+      "java.lang.Double" -> wrapperCode("Double","number","jdouble")
+      else -> userdataCode(type.name,"JavaObject")
+    }
+  }
+
+  private fun newCallbackCode():String{
+    return """
+      |jobject ${newCallbackFunctionName(callback)}(lua_State*L,JNIEnv*env,int index){
+      |  jobject obj = luaJniFindCallback(L,env,index,classInfo->name);
+      |  if(obj != NULL) return obj;
+      |  LuaJniCallback* callback = luaJniNewCallback(L,index);
+      |  obj = (*env)->NewObject(env,(jclass)luaJniTakeObject(env,classInfo->id),classInfo->constructor,(jlong)callback);
+      |  if(obj == NULL){
+      |    luaJniReleaseCallback(callback);
+      |  }else{
+      |    luaJniCacheCallback(L,env,index,classInfo->name,callback,obj);
+      |  }
+      |  return obj;
+      |}
+    """.trimMargin()
+  }
+
+  private fun registerCode():String{
+    return """
+      |int register_${injectToLuaMethodName()}(JNIEnv*env){
+      |  jclass clazz = (*env)->FindClass(env,"${className().replace(".","/")}");
+      |  JNINativeMethod methods[] = {
+      |    {"call","${callSignature()}",(void*)callback_call}
+      |  };
+      |  (*env)->RegisterNatives(env,clazz,methods,1);
+      |  classInfo = (ClassInfo*)malloc(sizeof(ClassInfo));
+      |  classInfo->name = "${className()}";
+      |  classInfo->constructor = (*env)->GetMethodID(env,clazz,"<init>","(J)V");
+      |  classInfo->id = luaJniCacheObject(env,clazz);
+      |  (*env)->DeleteLocalRef(env,clazz);
+      |  return 1;
+      |}
+    """.trimMargin()
+  }
+
+  private fun unregisterCode():String{
+    return """
+      |int unregister_${injectToLuaMethodName()}(JNIEnv*env){
+      |  if(classInfo != NULL){
+      |    luaJniReleaseObject(env,classInfo->id);
+      |    free(classInfo);
+      |    classInfo = NULL;
+      |  }
+      |  return 1;
+      |}
+    """.trimMargin()
+  }
+
+  companion object{
+    private const val UNIT = "kotlin.Unit"
+
+    private fun jniTypeName(type:CommonType):String{
+      return if(type.dimensions > 0) "jobject" else toJniTypeName(type.name)
+    }
+
+    private fun javaTypeName(type:CommonType):String{
+      return type.name.replace("$",".") + "[]".repeat(type.dimensions)
+    }
+  }
+}
@@ -2,6 +2,12 @@ package top.lizhistudio.annotation.processor
 
 import top.lizhistudio.annotation.processor.GenerateUtil.addDeleteLocalRef
 import top.lizhistudio.annotation.processor.GenerateUtil.addPutBackObject
+import top.lizhistudio.annotation.processor.GenerateUtil.bindingStatsCode
+import top.lizhistudio.annotation.processor.GenerateUtil.cachedFieldCode
+import top.lizhistudio.annotation.processor.GenerateUtil.callbackIncludeCode
+import top.lizhistudio.annotation.processor.GenerateUtil.enumIncludeCode
+import top.lizhistudio.annotation.processor.GenerateUtil.enumSymbol
+import top.lizhistudio.annotation.processor.GenerateUtil.isEnumType
 import top.lizhistudio.annotation.processor.GenerateUtil.generateArrayElementTypeCode
 import top.lizhistudio.annotation.processor.GenerateUtil.generateParametersName
 import top.lizhistudio.annotation.processor.GenerateUtil.generateReleaseContextCode
@@ -11,12 +17,15 @@ import top.lizhistudio.annotation.processor.GenerateUtil.getMethodIdCode
 import top.lizhistudio.annotation.processor.GenerateUtil.java2luaException
 import top.lizhistudio.annotation.processor.GenerateUtil.jniMethodType
 import top.lizhistudio.annotation.processor.GenerateUtil.mIndent
+import top.lizhistudio.annotation.processor.GenerateUtil.pushLocalFrameCode
 import top.lizhistudio.annotation.processor.GenerateUtil.setGlobalFunctionCode
 import top.lizhistudio.annotation.processor.GenerateUtil.shortName
 import top.lizhistudio.annotation.processor.GenerateUtil.toCConstructorName
 import top.lizhistudio.annotation.processor.GenerateUtil.toCFieldName
 import top.lizhistudio.annotation.processor.GenerateUtil.toCMethodName
 import top.lizhistudio.annotation.processor.GenerateUtil.toCParameterName
+import top.lizhistudio.annotation.processor.GenerateUtil.unpackFieldIdCode
+import top.lizhistudio.annotation.processor.GenerateUtil.unpackFieldsDeclareCode
 import top.lizhistudio.annotation.processor.GenerateUtil.unpackReturnCode
 import top.lizhistudio.annotation.processor.data.CommonField
 import top.lizhistudio.annotation.processor.data.CommonMethod
@@ -55,12 +64,15 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     return GenerateUtil.headerCode(this)
   }
   override fun sourceCode(): String {
+    val methodFunctionCode = methodFunctionCode()
     return """
     |${includeCode()}
     |
     |${cClassInfo()}
     |
-    |${methodFunctionCode()}
+    |${statsCode()}
+    |
+    |$methodFunctionCode
     |
     |${indexMethodCode()}
     |
@@ -84,6 +96,8 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     |#include "luajni.h"
     |#include <stdlib.h>
     |#include <string.h>
+    |${callbackIncludeCode(clazz.methods() + clazz.constructors() + functions,clazz.fields())}
+    |${enumIncludeCode(clazz.methods() + clazz.constructors() + functions,clazz.fields())}
     """.trimMargin()
     return code
   }
@@ -104,11 +118,34 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     |${fieldsCode.mIndent(2)}
     |${methodsCode.mIndent(2)}
     |${functionCode.mIndent(2)}
+    |${unpackFieldsDeclareCode(clazz.methods() + functions).mIndent(2)}
     |${clazz.constructors().joinToString("\n"){"jmethodID ${toCConstructorName(it)};"}.mIndent(2)}
     |}ClassInfo;
     """.trimMargin()
     return code
   }
+  private fun indexMemberNames():List<String>{
+    return (clazz.fields().map { it.indexName() } +
+            sortedMethods.map { it[0].indexName() } +
+            clazz.methods().filter { it.toField && it.parameters.isEmpty() }.map { it.indexName() }).distinct().sorted()
+  }
+
+  private fun newIndexMemberNames():List<String>{
+    return (clazz.fields().filter { !it.readonly }.map { it.indexName() } +
+            clazz.methods().filter { it.toField && it.parameters.size == 1 }.map { it.indexName() }).distinct().sorted()
+  }
+
+  //index_stats and newindex_stats are searched by key, the trailing entry collects unknown keys
+  private fun statsCode():String{
+    if(!GenerateUtil.statsEnabled) return ""
+    return listOf(
+      bindingStatsCode(className(),"method_stats",sortedMethods.map { it[0].indexName() }),
+      bindingStatsCode(className(),"index_stats",indexMemberNames() + UNKNOWN_MEMBER),
+      bindingStatsCode(className(),"newindex_stats",newIndexMemberNames() + UNKNOWN_MEMBER),
+      bindingStatsCode(className(),"constructor_stats",if(clazz.constructors().isEmpty()) emptyList() else listOf("<init>"))
+    ).filter { it.isNotEmpty() }.joinToString("\n")
+  }
+
   private fun methodFunctionCode():String{
     functions.forEach {
       methodSort(it)
@@ -134,14 +171,19 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     val indexOrigin = if(method.isStatic) 1 else 2
     return """
       |if(${isParametersTypeCode(method,context,indexOrigin)}){
+      |  ${context.pushLocalFrameCode(method.parameters.size,"\"${method.indexName()}\"",methodStatsCode(method))}
       |${initObject.mIndent(2)}
       |${GenerateUtil.parametersInitCode(method,context,indexOrigin).mIndent(2)}
       |${GenerateUtil.callMethodCode(method,context).mIndent(2)}
       |${generateReleaseContextCode(context).mIndent(2)}
-      |${unpackReturnCode(method.unpack).mIndent(2)}
+      |${unpackReturnCode(method).mIndent(2)}
       |}
     """.trimMargin()
   }
+  private fun methodStatsCode(method:CommonMethod):String{
+    return "&method_stats[${sortedMethods.indexOfFirst { it[0].indexName() == method.indexName() }}]"
+  }
+
   private fun methodFunctionCode(methods:List<CommonMethod>):String{
     var count = 0
     val code = methods.joinToString("\n"){ method ->
@@ -163,6 +205,8 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
   private fun indexMethodCode():String{
     val context = GeneratorContext()
     context.addPutBackObject("obj")
+    val pushFrameCode = context.pushLocalFrameCode(0,KEY_NAME,
+      "luaJniFindBindingStats(index_stats,${indexMemberNames().size + 1},$KEY_NAME)")
     var count = 0
     val fieldsCode = clazz.fields().joinToString("\n"){ field ->
       if(count++ ==0) fieldIndexCode(field,context) else "else "+ fieldIndexCode(field,context)
@@ -182,8 +226,10 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     |  JavaObject* object = (JavaObject*)luaL_checkudata(L,1,"${className()}");
     |  size_t keySize = 0;
     |  const char* $KEY_NAME = luaL_checklstring(L,2,&keySize);
-    |  jobject obj = luaJniTakeObject(env,object->id);
     |  JNIEnv* env = luaJniGetEnv(L);
+    |  jobject obj = luaJniTakeObject(env,object->id);
+    |${staticClassCode(context).mIndent(2)}
+    |  $pushFrameCode
     |${fieldsCode.mIndent(2)}
     |${methodsCode.mIndent(2)}
     |  else{
@@ -198,6 +244,8 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
   private fun newIndexMethodCode():String{
     val context = GeneratorContext()
     context.addPutBackObject("obj")
+    val pushFrameCode = context.pushLocalFrameCode(1,KEY_NAME,
+      "luaJniFindBindingStats(newindex_stats,${newIndexMemberNames().size + 1},$KEY_NAME)")
     var memberCount = 0
     val fields = clazz.fields().filter { !it.readonly}
     val methods = clazz.methods().filter { it.toField && it.parameters.size==1 }
@@ -219,8 +267,10 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     |  JavaObject* object = (JavaObject*)luaL_checkudata(L,1,"${className()}");
     |  size_t keySize = 0;
     |  const char* $KEY_NAME = luaL_checklstring(L,2,&keySize);
-    |  jobject obj = luaJniTakeObject(env,object->id);
     |  JNIEnv* env = luaJniGetEnv(L);
+    |  jobject obj = luaJniTakeObject(env,object->id);
+    |${staticClassCode(context).mIndent(2)}
+    |  $pushFrameCode
     |${memberCode.mIndent(2)}
     |  else{
     |${generateReleaseContextCode(context,0).mIndent(4)}
@@ -232,6 +282,15 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     """.trimMargin()
   }
 
+  //static fields and getters of the class are accessed through clazz
+  private fun staticClassCode(context: GeneratorContext):String{
+    val hasStatic = clazz.fields().any { it.static && it.constantValue == null } ||
+            clazz.methods().any { it.toField && it.isStatic }
+    if(!hasStatic) return ""
+    context.addPutBackObject("clazz")
+    return "jclass clazz = (jclass)luaJniTakeObject(env,classInfo->id);"
+  }
+
   private fun fieldNewIndexCode(field:CommonField,context:GeneratorContext):String{
     val top = context.needRelease.size
     return memberNameCompareCode(field.indexName(),"""
@@ -267,6 +326,7 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
       |$initFieldsCode
       |$initMethodIdCode
       |$initConstructorIdCode
+      |${unpackFieldIdCode(clazz.methods() + functions)}
     """.trimMargin()
   }
 
@@ -275,19 +335,19 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     if(clazz.constructors().isEmpty()) return ""
     val context = GeneratorContext()
     context.addPutBackObject("clazz")
+    val parameterCount = clazz.constructors().maxOf { it.parameters.size }
     return """
       |static int ${constructorFunctionName()}(lua_State*L){
       |  JNIEnv* env = luaJniGetEnv(L);
       |  ClassInfo* classInfo = (ClassInfo*)lua_touserdata(L,lua_upvalueindex(1));
       |  jclass clazz = (jclass)luaJniTakeObject(env,classInfo->id);
+      |  ${context.pushLocalFrameCode(parameterCount,"\"<init>\"","&constructor_stats[0]")}
       |${java2luaException(context).mIndent(2)}
       |  jobject obj = NULL;
       |${eachConstructorMethod(context).mIndent(2)}
       |  if(obj != NULL){
-      |    JavaObject* jniObject = (JavaObject*)lua_newuserdata(L,sizeof(JavaObject));
-      |    jniObject->id = luaJniCacheObject(env,obj);
+      |    luaJniNewObject(L,env,obj,"${className()}");
       |    (*env)->DeleteLocalRef(env,obj);
-      |    luaL_setmetatable(L,"${className()}");
       |  }else{
       |    lua_pushnil(L);
       |  }
@@ -312,7 +372,7 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
   private fun constructorMethodCode(constructor:CommonMethod,context: GeneratorContext):String{
     return """
       |if(${constructorMethodEqualsCode(constructor,context)}){
-      |${GenerateUtil.parametersInitCode(constructor,context,1,true).mIndent(2)}
+      |${GenerateUtil.parametersInitCode(constructor,context,1).mIndent(2)}
       |  obj = (*env)->NewObject(env,clazz,classInfo->${toCConstructorName(constructor)}${generateParametersName(constructor.parameters)});
       |${java2luaException(context).mIndent(2)}
       |}
@@ -381,10 +441,8 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
       |jobject obj = (*env)->NewObject(env,clazz,constructor);
       |${java2luaException(context).mIndent(2)}
       |if(obj != NULL){
-      |  JavaObject* jniObject = (JavaObject*)lua_newuserdata(L,sizeof(JavaObject));
-      |  jniObject->id = luaJniCacheObject(env,obj);
+      |  luaJniNewObject(L,env,obj,"${className()}");
       |  (*env)->DeleteLocalRef(env,obj);
-      |  luaL_setmetatable(L,"${className()}");
       |  lua_setglobal(L,"${clazz.shortName()}");
       |}
       |${generateReleaseContextCode(context)}
@@ -402,6 +460,7 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
 
   companion object {
     private const val KEY_NAME = "keyStr"
+    private const val UNKNOWN_MEMBER = "<unknown>"
 
     private fun memberNameCompareCode(memberName:String, memberCode:String): String {
       return """
@@ -425,7 +484,8 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     }
 
     private fun methodToFieldIndexCode(method: CommonMethod, context: GeneratorContext): String {
-      return memberNameCompareCode(method.indexName(),GenerateUtil.callMethodCode(method,context))
+      val code = GenerateUtil.callMethodCode(method,context)
+      return memberNameCompareCode(method.indexName(),if(method.cached) cachedFieldCode(method.indexName(),code) else code)
     }
 
     private fun methodIndexCode(method: CommonMethod, context: GeneratorContext): String {
@@ -440,16 +500,20 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     private fun setFieldCode(field:CommonField):String{
       val fieldName = toCFieldName(field)
       val paramName = toCParameterName(field.name)
-      return when(field.type.name){
-        "boolean" -> "(*env)->SetBooleanField(env,obj,classInfo->$fieldName,$paramName);"
-        "byte" -> "(*env)->SetByteField(env,obj,classInfo->$fieldName,$paramName);"
-        "short" -> "(*env)->SetShortField(env,obj,classInfo->$fieldName,$paramName);"
-        "int" -> "(*env)->SetIntField(env,obj,classInfo->$fieldName,$paramName);"
-        "long" -> "(*env)->SetLongField(env,obj,classInfo->$fieldName,$paramName);"
-        "float" -> "(*env)->SetFloatField(env,obj,classInfo->$fieldName,$paramName);"
-        "double" -> "(*env)->SetDoubleField(env,obj,classInfo->$fieldName,$paramName);"
-        else -> "(*env)->SetObjectField(env,obj,classInfo->$fieldName,$paramName);"
+      val staticStr = if(field.static) "Static" else ""
+      val obj = if(field.static) "clazz" else "obj"
+      val type = when(field.type.name){
+        "boolean" -> "Boolean"
+        "byte" -> "Byte"
+        "char" -> "Char"
+        "short" -> "Short"
+        "int" -> "Int"
+        "long" -> "Long"
+        "float" -> "Float"
+        "double" -> "Double"
+        else -> "Object"
       }
+      return "(*env)->Set${staticStr}${type}Field(env,$obj,classInfo->$fieldName,$paramName);"
     }
   }
 
@@ -472,8 +536,14 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     return isParametersTypeCode(method,context,1)
   }
   private fun isParameterTypeCode(type:CommonType,index:Int,context: GeneratorContext):String{
+    if(type.callback != null){
+      return "(lua_isnil(L,$index) || lua_isfunction(L,$index) || luaL_testudata(L,$index,\"${type.name}\") != NULL)"
+    }
+    if(isEnumType(type)){
+      return "(lua_isnil(L,$index) || luaJniEnumIndex(L,$index,&${enumSymbol(type.name)}) >= 0)"
+    }
     if(type.dimensions >0){
-      return "(lua_isnil(L,$index) || equalsJavaArray(lua_testudata(L,$index,\"JavaArray\"),${type.dimensions},\"${type.name}\",${generateArrayElementTypeCode(type.name)}))"
+      return "(lua_isnil(L,$index) || luaJniEqualJavaArray((JavaArray*)luaL_testudata(L,$index,\"JavaArray\"),\"${type.name}\",${type.dimensions},${generateArrayElementTypeCode(type.name)}))"
     }
     val wrapperCode = {name:String->
       "(lua_isnil(L,$index) || lua_is${name}(L,$index))"
@@ -481,6 +551,7 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
     return when(type.name){
       "boolean" ->  "lua_isboolean(L,$index)"
       "byte" ->  "lua_isinteger(L,$index)"
+      "char" ->  "lua_isinteger(L,$index)"
       "short" -> "lua_isinteger(L,$index)"
       "int" ->  "lua_isinteger(L,$index)"
       "long" ->  "lua_isinteger(L,$index)"
@@ -495,7 +566,7 @@ class ClassCodeGenerator(private val clazz:ClassMetaData):Generator,
       "java.lang.Float"-> wrapperCode("number")
       "java.lang.Double"-> wrapperCode("number")
       "java.lang.Character" -> wrapperCode("integer")
-      else -> "(lua_isnil(L,$index) || lua_testudata(L,$index,\"${type.name}\") != NULL)"
+      else -> "(lua_isnil(L,$index) || luaL_testudata(L,$index,\"${type.name}\") != NULL)"
     }
   }
 }
\ No newline at end of file
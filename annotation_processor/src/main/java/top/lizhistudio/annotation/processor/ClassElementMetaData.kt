@@ -8,6 +8,7 @@ import top.lizhistudio.annotation.processor.GenerateUtil.capitalizeFirstLetter
 import top.lizhistudio.annotation.processor.GenerateUtil.getJvmName
 import top.lizhistudio.annotation.processor.GenerateUtil.isStaticField
 import top.lizhistudio.annotation.processor.GenerateUtil.isStaticFunction
+import top.lizhistudio.annotation.processor.data.CommonCallback
 import top.lizhistudio.annotation.processor.data.CommonField
 import top.lizhistudio.annotation.processor.data.CommonMethod
 import top.lizhistudio.annotation.processor.data.CommonParameter
@@ -17,8 +18,11 @@ import javax.lang.model.element.ExecutableElement
 import javax.lang.model.element.Modifier
 import javax.lang.model.element.TypeElement
 import javax.lang.model.element.VariableElement
+import javax.lang.model.type.DeclaredType
 import javax.lang.model.type.TypeKind
 import javax.lang.model.type.TypeMirror
+import javax.lang.model.type.TypeVariable
+import javax.lang.model.type.WildcardType
 
 class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
   private val fields = mutableListOf<CommonField>()
@@ -40,11 +44,11 @@ class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
       }
     }
     if(clazz.getAnnotation(Metadata::class.java) != null){
-      fields.forEach {
+      fields.filter { it.constantValue == null }.forEach {
         methods.add(toGetterMethod(it))
         if(!it.readonly) methods.add(toSetterMethod(it))
       }
-      fields.clear()
+      fields.retainAll { it.constantValue != null }
     }
 
 
@@ -53,6 +57,10 @@ class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
     return clazz.getAnnotation(LuaClass::class.java).autoRegister
   }
 
+  override fun compact(): Boolean {
+    return clazz.getAnnotation(LuaClass::class.java).compact
+  }
+
   override fun fields(): List<CommonField> {
     return fields
   }
@@ -84,18 +92,86 @@ class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
       val alias = if(annotation?.alias.isNullOrEmpty()) name else annotation!!.alias
       val type = element.asType()
       val readonly = annotation?.readonly ?: false || element.modifiers.contains(Modifier.FINAL)
-      return CommonField(name, toCommonType(type),readonly = readonly,static = isStaticField(element),alias)
+      val cached = readonly && annotation?.cached ?: false
+      return CommonField(name, toCommonType(type),readonly = readonly,static = isStaticField(element),alias,
+        toConstantValue(element),cached)
+    }
+
+    //compile-time constants which can be written into the generated code
+    private fun toConstantValue(element:VariableElement):Any?{
+      return when(val value = element.constantValue){
+        is Float -> if(value.isFinite()) value else null
+        is Double -> if(value.isFinite()) value else null
+        else -> value
+      }
     }
     fun toCommonType(type:TypeMirror):CommonType{
+      return toCommonType(type,true)
+    }
+
+    private fun toCommonType(type:TypeMirror,resolveCallback:Boolean):CommonType{
       var t = type
       var count = 0
       while(t.kind == TypeKind.ARRAY){
         t = (t as javax.lang.model.type.ArrayType).componentType
         count++
       }
+      if(t.kind == TypeKind.DECLARED){
+        t as DeclaredType
+        val callback = if(resolveCallback && count == 0) toCommonCallback(t) else null
+        return CommonType(getJvmName(t.asElement()),count,callback)
+      }
       return CommonType(t.toString(),count)
     }
 
+    private fun toCommonCallback(type:DeclaredType):CommonCallback?{
+      val element = type.asElement() as TypeElement
+      if(element.kind != ElementKind.INTERFACE) return null
+      val methods = abstractMethods(element).distinctBy { "${it.simpleName}/${it.parameters.size}" }
+      if(methods.size != 1) return null
+      val method = methods[0]
+      val arguments = element.typeParameters.zip(type.typeArguments).associate { (parameter,argument) ->
+        parameter.simpleName.toString() to (typeArgumentBound(argument) ?: parameter.bounds[0])
+      }
+      val resolve = { mirror:TypeMirror ->
+        if(mirror.kind == TypeKind.TYPEVAR){
+          arguments[mirror.toString()] ?: (mirror as TypeVariable).upperBound
+        }else mirror
+      }
+      return CommonCallback(getJvmName(element),
+        element.qualifiedName.toString(),
+        arguments.values.map { it.toString() },
+        method.simpleName.toString(),
+        toCommonType(resolve(method.returnType),false),
+        method.parameters.map { toCommonType(resolve(it.asType()),false) })
+    }
+
+    private fun typeArgumentBound(type:TypeMirror):TypeMirror?{
+      if(type.kind != TypeKind.WILDCARD) return type
+      type as WildcardType
+      return type.superBound ?: type.extendsBound
+    }
+
+    private fun abstractMethods(element:TypeElement):List<ExecutableElement>{
+      val methods = element.enclosedElements.filter {
+        it.kind == ElementKind.METHOD &&
+                it.modifiers.contains(Modifier.ABSTRACT) &&
+                !isObjectMethod(it as ExecutableElement)
+      }.map { it as ExecutableElement }.toMutableList()
+      element.interfaces.forEach {
+        methods.addAll(abstractMethods((it as DeclaredType).asElement() as TypeElement))
+      }
+      return methods
+    }
+
+    private fun isObjectMethod(method:ExecutableElement):Boolean{
+      return when(method.simpleName.toString()){
+        "equals" -> method.parameters.size == 1
+        "hashCode","toString" -> method.parameters.isEmpty()
+        else -> false
+      }
+    }
+
     fun toCommonMethodWithLuaField(element:ExecutableElement):CommonMethod{
       val annotation = element.getAnnotation(LuaField::class.java)
         ?: throw IllegalArgumentException("element is not annotated with LuaField")
@@ -110,7 +186,9 @@ class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
         annotation.method2field,
         isStaticFunction(element),
         alias,
-        unpack)
+        unpack,
+        cached = annotation.cached && annotation.method2field && parameters.isEmpty(),
+        unpackFields = if(annotation.method2field) null else toUnpackFields(returnType,unpack))
     }
 
     fun toCommonMethodWithLuaFunction(element:ExecutableElement):CommonMethod{
@@ -127,7 +205,28 @@ class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
         false,
         isStaticFunction(element),
         alias,
-        unpack)
+        unpack,
+        unpackFields = toUnpackFields(returnType,unpack))
+    }
+
+    //instance fields of the returned class named by unpack, null when any key is not a plain field
+    private fun toUnpackFields(returnType:TypeMirror,unpack:Array<String>?):List<CommonField>?{
+      if(unpack == null || returnType.kind != TypeKind.DECLARED) return null
+      val fields = mutableListOf<VariableElement>()
+      var element = (returnType as DeclaredType).asElement() as? TypeElement
+      while(element != null){
+        fields.addAll(element.enclosedElements.filter {
+          it.kind == ElementKind.FIELD && !it.modifiers.contains(Modifier.STATIC)
+        }.map { it as VariableElement })
+        element = (element.superclass as? DeclaredType)?.asElement() as? TypeElement
+      }
+      return unpack.map { key ->
+        val field = fields.firstOrNull { it.getAnnotation(LuaField::class.java)?.alias == key }
+          ?: fields.firstOrNull { it.simpleName.toString() == key }
+          ?: return null
+        if(field.asType().kind == TypeKind.TYPEVAR) return null
+        toCommonField(field)
+      }
     }
 
     fun toCommonParameter(element:VariableElement): CommonParameter {
@@ -147,7 +246,8 @@ class ClassElementMetaData(private val clazz:TypeElement): ClassMetaData {
         field.type,emptyList(),
         true,
         field.static,
-        field.alias)
+        field.alias,
+        cached = field.cached)
     }
     private fun toSetterMethod(field:CommonField):CommonMethod{
       return CommonMethod(toSetterName(field.name),
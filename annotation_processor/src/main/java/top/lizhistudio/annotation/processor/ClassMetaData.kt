@@ -5,6 +5,7 @@ import top.lizhistudio.annotation.processor.data.CommonMethod
 
 interface ClassMetaData:MetaData {
   fun autoRegister():Boolean
+  fun compact():Boolean
   fun fields():List<CommonField>
   fun methods():List<CommonMethod>
   fun constructors():List<CommonMethod>
@@ -0,0 +1,169 @@
+package top.lizhistudio.annotation.processor
+
+import top.lizhistudio.annotation.processor.GenerateUtil.callbackIncludeCode
+import top.lizhistudio.annotation.processor.GenerateUtil.generateArrayElementTypeCode
+import top.lizhistudio.annotation.processor.GenerateUtil.jniMethodType
+import top.lizhistudio.annotation.processor.GenerateUtil.jniParameterType
+import top.lizhistudio.annotation.processor.GenerateUtil.mIndent
+import top.lizhistudio.annotation.processor.GenerateUtil.newCallbackFunctionName
+import top.lizhistudio.annotation.processor.GenerateUtil.shortName
+import top.lizhistudio.annotation.processor.data.CommonField
+import top.lizhistudio.annotation.processor.data.CommonMethod
+import top.lizhistudio.annotation.processor.data.CommonType
+import top.lizhistudio.annotation.processor.data.indexName
+
+/**
+ * Emits static descriptor tables instead of a specialised C body per member,
+ * the tables are interpreted by luaJniRegisterClassDescriptor at runtime.
+ */
+class CompactClassCodeGenerator(private val clazz:ClassMetaData):Generator,
+  MetaData by clazz
+  ,FunctionContainer
+{
+  private val functions = mutableListOf<CommonMethod>()
+
+  override fun headerCode(): String {
+    return GenerateUtil.headerCode(this)
+  }
+
+  override fun sourceCode(): String {
+    val members = membersCode()
+    val membersTable = if(members.isEmpty()) "" else """
+      |static const LuaJniMemberDescriptor members[] = {
+      |${members.joinToString(",\n").mIndent(2)}
+      |};
+    """.trimMargin()
+    return """
+    |#include "${fileName()}.h"
+    |#include "luajni.h"
+    |${callbackIncludeCode(clazz.methods() + clazz.constructors() + functions,clazz.fields())}
+    |
+    |${argsCode()}
+    |
+    |$membersTable
+    |
+    |static const LuaJniClassDescriptor descriptor = {
+    |  "${className()}",
+    |  "${className().replace(".","/")}",
+    |  "${clazz.shortName()}",
+    |  ${if(clazz.autoRegister()) 1 else 0},
+    |  ${members.size},
+    |  ${if(members.isEmpty()) "NULL" else "members"},
+    |  ${if(GenerateUtil.statsEnabled) 1 else 0}
+    |};
+    |
+    |int register_${injectToLuaMethodName()}(JNIEnv*env){
+    |  return luaJniRegisterClassDescriptor(env,&descriptor);
+    |}
+    |
+    |int unregister_${injectToLuaMethodName()}(JNIEnv*env){
+    |  return luaJniUnregisterClassDescriptor(env,&descriptor);
+    |}
+    """.trimMargin()
+  }
+
+  private fun allMethods():List<Pair<String,CommonMethod>>{
+    return clazz.constructors().map { "MEMBER_CONSTRUCTOR" to it } +
+            clazz.methods().map { method ->
+              val kind = when{
+                !method.toField -> "MEMBER_METHOD"
+                method.parameters.isEmpty() -> "MEMBER_GETTER"
+                else -> "MEMBER_SETTER"
+              }
+              kind to method
+            } +
+            functions.map { "MEMBER_FUNCTION" to it }
+  }
+
+  private fun argsCode():String{
+    return allMethods().withIndex().joinToString("\n"){ (index,pair) ->
+      val method = pair.second
+      val unpack = method.unpack
+      val unpackCode = if(unpack.isNullOrEmpty()) "" else
+        "static const char* const unpack_$index[] = {${unpack.joinToString(",") { "\"$it\"" }}};"
+      val argsCode = if(method.parameters.isEmpty()) "" else
+        "static const LuaJniTypeDescriptor args_$index[] = {${method.parameters.joinToString(",") { typeDescriptor(it.type) }}};"
+      listOf(argsCode,unpackCode).filter { it.isNotEmpty() }.joinToString("\n")
+    }.lines().filter { it.isNotEmpty() }.joinToString("\n")
+  }
+
+  private fun membersCode():List<String>{
+    val fieldsCode = clazz.fields().map { fieldDescriptor(it) }
+    val methodsCode = allMethods().withIndex().map { (index,pair) ->
+      val (kind,method) = pair
+      val isConstructor = kind == "MEMBER_CONSTRUCTOR"
+      val isStatic = isConstructor || kind == "MEMBER_FUNCTION" || method.isStatic
+      val unpack = method.unpack
+      val name = if(isConstructor) "<init>" else method.indexName()
+      val javaName = if(isConstructor) "<init>" else method.name
+      val argsName = if(method.parameters.isEmpty()) "NULL" else "args_$index"
+      val unpackName = if(unpack.isNullOrEmpty()) "NULL" else "unpack_$index"
+      "{\"$name\",\"$javaName\",\"${jniMethodType(method)}\",$kind,${if(isStatic) 1 else 0},0,${if(method.cached) 1 else 0}," +
+              "${typeDescriptor(method.returnType)},${method.parameters.size},$argsName,${unpack?.size ?: 0},$unpackName}"
+    }
+    return fieldsCode + methodsCode
+  }
+
+  //constants are read once per object and then served from the cache
+  private fun fieldDescriptor(field:CommonField):String{
+    val cached = field.cached || field.constantValue != null
+    return "{\"${field.indexName()}\",\"${field.name}\",\"${jniParameterType(field.type)}\",MEMBER_FIELD," +
+            "${if(field.static) 1 else 0},${if(field.readonly) 1 else 0},${if(cached) 1 else 0},${typeDescriptor(field.type)},0,NULL,0,NULL}"
+  }
+
+  //a @LuaFunction of the class is only known after the generator has been chosen
+  fun accepts(f:CommonMethod):Boolean = supports(clazz,functions + f)
+
+  fun toClassCodeGenerator():ClassCodeGenerator{
+    val generator = ClassCodeGenerator(clazz)
+    functions.forEach { generator.putFunction(it) }
+    return generator
+  }
+
+  override fun putFunction(f: CommonMethod) {
+    functions.add(f)
+  }
+
+  companion object{
+    private fun typeDescriptor(type:CommonType):String{
+      if(type.dimensions > 0){
+        return "{VALUE_ARRAY,\"${type.name}\",${type.dimensions},${generateArrayElementTypeCode(type.name)},NULL}"
+      }
+      if(type.callback != null){
+        return "{VALUE_CALLBACK,\"${type.name}\",0,ELEMENT_OBJECT,${newCallbackFunctionName(type.callback)}}"
+      }
+      val valueType = when(type.name){
+        "void" -> "VALUE_VOID"
+        "boolean" -> "VALUE_BOOLEAN"
+        "byte" -> "VALUE_BYTE"
+        "char" -> "VALUE_CHAR"
+        "short" -> "VALUE_SHORT"
+        "int" -> "VALUE_INT"
+        "long" -> "VALUE_LONG"
+        "float" -> "VALUE_FLOAT"
+        "double" -> "VALUE_DOUBLE"
+        "java.lang.String" -> "VALUE_STRING"
+        "java.lang.Boolean" -> "VALUE_WRAPPER_BOOLEAN"
+        "java.lang.Byte" -> "VALUE_WRAPPER_BYTE"
+        "java.lang.Character" -> "VALUE_WRAPPER_CHAR"
+        "java.lang.Short" -> "VALUE_WRAPPER_SHORT"
+        "java.lang.Integer" -> "VALUE_WRAPPER_INT"
+        "java.lang.Long" -> "VALUE_WRAPPER_LONG"
+        "java.lang.Float" -> "VALUE_WRAPPER_FLOAT"
+        "java.lang.Double" -> "VALUE_WRAPPER_DOUBLE"
+        else -> "VALUE_OBJECT"
+      }
+      return "{$valueType,\"${type.name}\",0,ELEMENT_OBJECT,NULL}"
+    }
+
+    //enum members need the generated LuaJniEnum tables, which the descriptors do not carry
+    fun supports(clazz:ClassMetaData, functions:List<CommonMethod> = emptyList()):Boolean{
+      val methods = clazz.methods() + clazz.constructors() + functions
+      val types = methods.flatMap { method -> method.parameters.map { it.type } + method.returnType } +
+              clazz.fields().map { it.type }
+      return methods.all { it.parameters.size <= LUA_JNI_MAX_ARGS } && types.none { GenerateUtil.isEnumType(it) }
+    }
+
+    private const val LUA_JNI_MAX_ARGS = 32
+  }
+}
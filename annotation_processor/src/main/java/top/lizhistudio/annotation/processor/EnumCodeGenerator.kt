@@ -2,6 +2,7 @@ package top.lizhistudio.annotation.processor
 
 
 import top.lizhistudio.annotation.LuaEnum
+import top.lizhistudio.annotation.processor.GenerateUtil.enumSymbol
 import top.lizhistudio.annotation.processor.GenerateUtil.getJvmName
 import top.lizhistudio.annotation.processor.GenerateUtil.mIndent
 import top.lizhistudio.annotation.processor.GenerateUtil.shortName
@@ -13,6 +14,11 @@ import javax.lang.model.element.VariableElement
 class EnumCodeGenerator(private val clazz: TypeElement):Generator {
   data class EnumField(val name: String, val value: Int)
   private val fields = mutableListOf<EnumField>()
+  //constants of a java enum class in ordinal order
+  private val constants = clazz.enclosedElements
+    .filter { it.kind == ElementKind.ENUM_CONSTANT }
+    .map { it.simpleName.toString() }
+  private val isEnumClass = clazz.kind == ElementKind.ENUM
   init {
     clazz.enclosedElements.filter {
       it is VariableElement && it.kind == ElementKind.FIELD && it.constantValue !=null
@@ -30,10 +36,15 @@ class EnumCodeGenerator(private val clazz: TypeElement):Generator {
 
 
   override fun headerCode(): String {
-    return GenerateUtil.headerCode(this)
+    if(!isEnumClass) return GenerateUtil.headerCode(this)
+    return GenerateUtil.headerCode(this,"""
+      |#include "luajni.h"
+      |extern LuaJniEnum ${enumSymbol(className())};
+    """.trimMargin())
   }
 
   override fun sourceCode(): String {
+    if(isEnumClass) return enumClassSourceCode()
     return """
       |#include "${fileName()}.h"
       |#include <jni.h>
@@ -49,6 +60,48 @@ class EnumCodeGenerator(private val clazz: TypeElement):Generator {
   }
 
 
+  private fun enumClassSourceCode():String{
+    val symbol = enumSymbol(className())
+    val namesCode = if(constants.isEmpty()) "NULL" else "names"
+    return """
+      |#include "${fileName()}.h"
+      |#include <jni.h>
+      |#include "luajni.h"
+      |#include "lua.h"
+      |
+      |${if(constants.isEmpty()) "" else "static const char*const names[] = {${constants.joinToString(",") { "\"$it\"" }}};"}
+      |LuaJniEnum $symbol = {"${className()}",${constants.size},$namesCode,NULL,NULL};
+      |
+      |static int ${injectToLuaMethodName()}(struct lua_State*L,JNIEnv*env,void*_){
+      |  lua_createtable(L,0,${constants.size});
+      |  for(int i = 0;i < $symbol.count;i++){
+      |    lua_pushstring(L,$symbol.names[i]);
+      |    lua_setfield(L,-2,$symbol.names[i]);
+      |  }
+      |  lua_setglobal(L,"${name()}");
+      |  return 0;
+      |}
+      |
+      |int register_${injectToLuaMethodName()}(JNIEnv*env){
+      |  jclass clazz = (*env)->FindClass(env,"${className().replace(".","/")}");
+      |  if(clazz == NULL){
+      |    (*env)->ExceptionClear(env);
+      |    return 0;
+      |  }
+      |  int r = luaJniInitEnum(env,&$symbol,clazz);
+      |  (*env)->DeleteLocalRef(env,clazz);
+      |  if(r) luaJniRegister("${className()}",${injectToLuaMethodName()},NULL);
+      |  return r;
+      |}
+      |
+      |int unregister_${injectToLuaMethodName()}(JNIEnv*env){
+      |  luaJniUnregister("${className()}");
+      |  luaJniReleaseEnum(env,&$symbol);
+      |  return 1;
+      |}
+    """.trimMargin()
+  }
+
   private fun injectMethodCode():String{
     return """
       |static int ${injectToLuaMethodName()}(struct lua_State*L,JNIEnv*env,void*_){
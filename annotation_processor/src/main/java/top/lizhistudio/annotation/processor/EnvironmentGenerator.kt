@@ -2,6 +2,7 @@ package top.lizhistudio.annotation.processor
 
 import top.lizhistudio.annotation.processor.ClassElementMetaData.Companion.toCommonField
 import top.lizhistudio.annotation.processor.GenerateUtil.addPutBackObject
+import top.lizhistudio.annotation.processor.GenerateUtil.enumIncludeCode
 import top.lizhistudio.annotation.processor.GenerateUtil.generateGetField
 import top.lizhistudio.annotation.processor.GenerateUtil.generateReleaseContextCode
 import top.lizhistudio.annotation.processor.GenerateUtil.getFieldIdCode
@@ -40,6 +41,7 @@ class EnvironmentGenerator(private val clazz:TypeElement): CommonGenerator() {
     |#include"lualib.h"
     |#include"luajni.h"
     |#include <stdlib.h>
+    |${enumIncludeCode(emptyList(),fields)}
     """.trimMargin()
   }
   private fun classInfoCode():String{
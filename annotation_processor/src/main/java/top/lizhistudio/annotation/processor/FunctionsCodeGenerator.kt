@@ -1,18 +1,25 @@
 package top.lizhistudio.annotation.processor
 
 import top.lizhistudio.annotation.processor.GenerateUtil.addPutBackObject
+import top.lizhistudio.annotation.processor.GenerateUtil.bindingStatsCode
+import top.lizhistudio.annotation.processor.GenerateUtil.callbackIncludeCode
+import top.lizhistudio.annotation.processor.GenerateUtil.enumIncludeCode
 import top.lizhistudio.annotation.processor.GenerateUtil.generateReleaseContextCode
 import top.lizhistudio.annotation.processor.GenerateUtil.getJvmName
 import top.lizhistudio.annotation.processor.GenerateUtil.getMethodIdCode
 import top.lizhistudio.annotation.processor.GenerateUtil.isKotlinObject
 import top.lizhistudio.annotation.processor.GenerateUtil.mIndent
 import top.lizhistudio.annotation.processor.GenerateUtil.methodCallName
+import top.lizhistudio.annotation.processor.GenerateUtil.pushLocalFrameCode
 import top.lizhistudio.annotation.processor.GenerateUtil.setGlobalFunctionCode
 import top.lizhistudio.annotation.processor.GenerateUtil.toCMethodName
 import top.lizhistudio.annotation.processor.GenerateUtil.toJniTypeName
+import top.lizhistudio.annotation.processor.GenerateUtil.unpackFieldIdCode
+import top.lizhistudio.annotation.processor.GenerateUtil.unpackFieldsDeclareCode
 import top.lizhistudio.annotation.processor.GenerateUtil.unpackReturnCode
 import top.lizhistudio.annotation.processor.data.CommonMethod
 import top.lizhistudio.annotation.processor.data.GeneratorContext
+import top.lizhistudio.annotation.processor.data.indexName
 import javax.lang.model.element.TypeElement
 
 class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionContainer {
@@ -31,9 +38,13 @@ class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionCo
       |#include <stdlib.h>
       |#include "lualib.h"
       |#include "lauxlib.h"
+      |${callbackIncludeCode(functions)}
+      |${enumIncludeCode(functions)}
       |
       |${classInfoCode()}
       |
+      |${statsCode()}
+      |
       |${methodCallCode()}
       |
       |${injectMethodCode()}
@@ -50,6 +61,7 @@ class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionCo
       |  int64_t id;
       |  ${if(isKotlinObject(clazz)) "int64_t instanceId;" else ""}
       |${functions.joinToString("\n"){"jmethodID ${toCMethodName(it)};"}.mIndent(2)}
+      |${unpackFieldsDeclareCode(functions).mIndent(2)}
       |}ClassInfo;
     """.trimMargin()
   }
@@ -63,9 +75,14 @@ class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionCo
     """.trimMargin()
   }
 
+  private fun statsCode():String{
+    if(!GenerateUtil.statsEnabled) return ""
+    return bindingStatsCode(className(),"function_stats",functions.map { it.indexName() })
+  }
+
   private fun methodCallCode():String{
     val isKotlinObject = isKotlinObject(clazz)
-    return functions.joinToString("\n") { methodCallCode(it,isKotlinObject) }
+    return functions.withIndex().joinToString("\n") { (index,method) -> methodCallCode(method,index,isKotlinObject) }
   }
 
   override fun className(): String {
@@ -98,6 +115,7 @@ class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionCo
       |  ClassInfo* classInfo = (ClassInfo*)malloc(sizeof(ClassInfo));
       |  classInfo->name = "${className()}";
       |  jclass clazz = (*env)->FindClass(env,"${className().replace(".","/")}");
+      |${unpackFieldIdCode(functions).mIndent(2)}
       |  classInfo->id = luaJniCacheObject(env,clazz);
       |${initInstanceId.mIndent(2)}
       |${initMethodIdCode.mIndent(2)}
@@ -129,7 +147,7 @@ class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionCo
 
   companion object{
 
-    private fun methodCallCode(method:CommonMethod,isKotlinObject:Boolean=false):String{
+    private fun methodCallCode(method:CommonMethod,index:Int,isKotlinObject:Boolean=false):String{
       val context = GeneratorContext()
       val objCode = if(isKotlinObject){
         context.addPutBackObject("obj")
@@ -144,10 +162,11 @@ class FunctionsCodeGenerator(private val clazz:TypeElement):Generator,FunctionCo
         |  JNIEnv* env = luaJniGetEnv(L);
         |  $objCode
         |${GenerateUtil.parametersCheckCode(method,context,1).mIndent(2)}
-        |${GenerateUtil.parametersInitCode(method,context,1,true).mIndent(2)}
+        |  ${context.pushLocalFrameCode(method.parameters.size,"\"${method.indexName()}\"","&function_stats[$index]")}
+        |${GenerateUtil.parametersInitCode(method,context,1).mIndent(2)}
         |${GenerateUtil.callMethodCode(method,context).mIndent(2)}
         |${generateReleaseContextCode(context).mIndent(2)}
-        |${unpackReturnCode(method.unpack).mIndent(2)}
+        |${unpackReturnCode(method).mIndent(2)}
         |}
       """.trimMargin()
     }
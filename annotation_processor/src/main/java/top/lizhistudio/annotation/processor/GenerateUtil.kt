@@ -2,6 +2,7 @@ package top.lizhistudio.annotation.processor
 
 
 import androidx.privacysandbox.tools.kotlinx.metadata.jvm.KotlinClassMetadata
+import top.lizhistudio.annotation.processor.data.CommonCallback
 import top.lizhistudio.annotation.processor.data.CommonField
 import top.lizhistudio.annotation.processor.data.CommonMethod
 import top.lizhistudio.annotation.processor.data.CommonParameter
@@ -15,13 +16,24 @@ import javax.lang.model.element.TypeElement
 import javax.lang.model.element.VariableElement
 
 object GenerateUtil {
+  //jvm names of the @LuaEnum enum classes, their values are passed as constant names
+  val enumTypes = mutableSetOf<String>()
 
-  private fun generateCommonGetField(cFieldName:String, fieldType:String,isStatic:Boolean=false):String{
+  fun isEnumType(type:CommonType):Boolean{
+    return type.dimensions == 0 && type.callback == null && enumTypes.contains(type.name)
+  }
+
+  fun enumSymbol(className:String):String{
+    return "luaJniEnum_${className.replace(".","_").replace("$","__")}"
+  }
+
+  private fun generateCommonGetField(cFieldName:String, fieldType:String,isStatic:Boolean=false,
+                                     target:String = if(isStatic) "clazz" else "obj"):String{
     val wrapperCode = {name:String->
-      "luaJniPush${if(isStatic)"Static" else ""}Wrapper${name}Field(L,env,${if(isStatic)"clazz" else "obj"},classInfo->$cFieldName)"
+      "luaJniPush${if(isStatic)"Static" else ""}Wrapper${name}Field(L,env,$target,classInfo->$cFieldName)"
     }
     val commonCode = {name:String->
-      "luaJniPush${if(isStatic)"Static" else ""}${name}Field(L,env,${if(isStatic)"clazz" else "obj"},classInfo->$cFieldName)"
+      "luaJniPush${if(isStatic)"Static" else ""}${name}Field(L,env,$target,classInfo->$cFieldName)"
     }
     return when(fieldType){
       "short" -> commonCode("Short")
@@ -31,6 +43,7 @@ object GenerateUtil {
       "float" -> commonCode("Float")
       "double" -> commonCode("Double")
       "boolean" -> commonCode("Boolean")
+      "char" -> commonCode("Char")
       "java.lang.String" -> commonCode("String")
       "java.lang.Boolean" -> wrapperCode("Boolean")
       "java.lang.Byte" -> wrapperCode("Byte")
@@ -40,36 +53,80 @@ object GenerateUtil {
       "java.lang.Float" -> wrapperCode("Float")
       "java.lang.Double" -> wrapperCode("Double")
       "java.lang.Character" -> wrapperCode("Char")
-      else -> "luaJniPush${if(isStatic) "Static" else ""}ObjectField(L,env,obj,classInfo->$cFieldName,\"$fieldType\")"
+      in enumTypes -> "luaJniPush${if(isStatic) "Static" else ""}EnumField(L,env,$target,classInfo->$cFieldName,&${enumSymbol(fieldType)})"
+      else -> "luaJniPush${if(isStatic) "Static" else ""}ObjectField(L,env,$target,classInfo->$cFieldName,\"$fieldType\")"
     }
   }
   fun generateArrayElementTypeCode(elementType:String):String{
     return when(elementType){
-      "boolean" -> "ARRAY_ELEMENT_TYPE::ELEMENT_BOOLEAN"
-      "byte" -> "ARRAY_ELEMENT_TYPE::ELEMENT_BYTE"
-      "short" -> "ARRAY_ELEMENT_TYPE::ELEMENT_SHORT"
-      "int" -> "ARRAY_ELEMENT_TYPE::ELEMENT_INT"
-      "long" -> "ARRAY_ELEMENT_TYPE::ELEMENT_LONG"
-      "float" -> "ARRAY_ELEMENT_TYPE::ELEMENT_FLOAT"
-      "double" -> "ARRAY_ELEMENT_TYPE::ELEMENT_DOUBLE"
-      "string" -> "ARRAY_ELEMENT_TYPE::ELEMENT_STRING"
-      else -> "ARRAY_ELEMENT_TYPE::ELEMENT_OBJECT"
-    }
-  }
-  private fun generateGetField(cFieldName:String, fieldType:String, dimensions:Int,isStatic: Boolean):String{
+      "boolean" -> "ELEMENT_BOOLEAN"
+      "byte" -> "ELEMENT_BYTE"
+      "char" -> "ELEMENT_CHAR"
+      "short" -> "ELEMENT_SHORT"
+      "int" -> "ELEMENT_INT"
+      "long" -> "ELEMENT_LONG"
+      "float" -> "ELEMENT_FLOAT"
+      "double" -> "ELEMENT_DOUBLE"
+      "java.lang.String" -> "ELEMENT_STRING"
+      else -> "ELEMENT_OBJECT"
+    }
+  }
+  private fun generateGetField(cFieldName:String, fieldType:String, dimensions:Int,isStatic: Boolean,
+                               target:String = if(isStatic) "clazz" else "obj"):String{
     if(dimensions == 0){
-      return generateCommonGetField(cFieldName, fieldType,isStatic)
+      return generateCommonGetField(cFieldName, fieldType,isStatic,target)
     }
     val elementType = generateArrayElementTypeCode(fieldType)
-    return "luaJniPush${if(isStatic) "Static" else ""}ArrayField(L,env,obj,classInfo->$cFieldName,\"$fieldType\",$dimensions,$elementType)"
+    return "luaJniPush${if(isStatic) "Static" else ""}ArrayField(L,env,$target,classInfo->$cFieldName,\"$fieldType\",$dimensions,$elementType)"
   }
   fun generateGetField(field:CommonField,context: GeneratorContext):String{
-    return """
+    field.constantValue?.let { return constantPushCode(it) }
+    val code = """
       |if(${generateGetField(toCFieldName(field),field.type.name,field.type.dimensions,field.static)} == 0){
       |${generateReleaseContextCode(context).mIndent(2)}
       |  lua_error(L);
       |}
     """.trimMargin()
+    return if(field.cached) cachedFieldCode(field.indexName(),code) else code
+  }
+
+  //the object must be at index 1
+  fun cachedFieldCode(name:String,pushCode:String):String{
+    return """
+      |if(!luaJniPushCachedField(L,1,"$name")){
+      |${pushCode.mIndent(2)}
+      |  luaJniCacheField(L,1,"$name");
+      |}
+    """.trimMargin()
+  }
+
+  fun constantPushCode(value:Any):String{
+    return when(value){
+      is Boolean -> "lua_pushboolean(L,${if(value) 1 else 0});"
+      is Char -> "lua_pushinteger(L,${value.code});"
+      is Long -> if(value == Long.MIN_VALUE) "lua_pushinteger(L,LUA_MININTEGER);" else "lua_pushinteger(L,${value}LL);"
+      is Byte,is Short,is Int -> "lua_pushinteger(L,$value);"
+      is Float -> "lua_pushnumber(L,${value.toDouble()});"
+      is Double -> "lua_pushnumber(L,$value);"
+      is String -> {
+        val bytes = value.toByteArray(Charsets.UTF_8)
+        "lua_pushlstring(L,${cStringLiteral(bytes)},${bytes.size});"
+      }
+      else -> throw IllegalArgumentException("Unsupported constant $value")
+    }
+  }
+
+  private fun cStringLiteral(bytes:ByteArray):String{
+    val builder = StringBuilder("\"")
+    bytes.forEach {
+      val c = it.toInt() and 0xff
+      when {
+        c == '"'.code || c == '\\'.code || c == '?'.code -> builder.append('\\').append(c.toChar())
+        c in 0x20..0x7e -> builder.append(c.toChar())
+        else -> builder.append("\\%03o".format(c))
+      }
+    }
+    return builder.append("\"").toString()
   }
 
   fun toCFieldName(field:CommonField):String{
@@ -111,15 +168,54 @@ object GenerateUtil {
   }
   fun generateReleaseContextCode(context: GeneratorContext,origin:Int = 0):String{
 //    println("generateReleaseContextCode:${context.needRelease},${context.needRelease.lastIndex},${origin}")
-    return context.needRelease.subList(origin,context.needRelease.size).joinToString("\n"){
+    val releaseCode = context.needRelease.subList(origin,context.needRelease.size).joinToString("\n"){
       "$it;"
     }
+    return if(origin == 0 && context.localFrame) "$releaseCode\nluaJniPopLocalFrame(L,env);" else releaseCode
+  }
+
+  //set from the luajni.stats processor option, the generated members record LuaJniBindingStats
+  var statsEnabled = false
+
+  //release code generated after this call also pops the frame, member is a c expression naming the bound member
+  //and stats the LuaJniBindingStats* recording it when statsEnabled
+  fun GeneratorContext.pushLocalFrameCode(parameterCount:Int,member:String,stats:String? = null):String{
+    localFrame = true
+    if(statsEnabled && stats != null){
+      return "luaJniPushStatsFrame(L,env,${parameterCount}+LUA_JNI_LOCAL_FRAME_CAPACITY,$stats);"
+    }
+    return "luaJniPushBindingFrame(L,env,${parameterCount}+LUA_JNI_LOCAL_FRAME_CAPACITY,classInfo->name,$member);"
+  }
+
+  fun bindingStatsCode(className:String,name:String,members:List<String>):String{
+    if(members.isEmpty()) return ""
+    return "static LuaJniBindingStats $name[] = {${members.joinToString(",") { "{\"$className\",\"$it\"}" }}};"
   }
 
 
   fun callMethodCode(method:CommonMethod, context: GeneratorContext):String{
     val staticStr = if(method.isStatic) "Static" else ""
     val obj = if(method.isStatic) "clazz" else "obj"
+    method.unpackFields?.let { fields ->
+      context.addDeleteLocalRef("result")
+      val pushCode = fields.withIndex().joinToString("\n") { (index,field) ->
+        """
+          |if(${generateGetField(unpackFieldName(method,index),field.type.name,field.type.dimensions,false,"result")} == 0){
+          |${generateReleaseContextCode(context).mIndent(2)}
+          |  lua_error(L);
+          |}
+        """.trimMargin()
+      }
+      return """
+          |jobject result = (*env)->Call${staticStr}ObjectMethod(env,$obj,classInfo->${toCMethodName(method)}${generateParametersName(method.parameters)});
+          |${java2luaException(context)}
+          |if(result == NULL){
+          |${"lua_pushnil(L);".repeat(fields.size).mIndent(2)}
+          |}else{
+          |${pushCode.mIndent(2)}
+          |}
+        """.trimMargin()
+    }
     if(method.returnType.dimensions>0){
       return """
           |jobject result = (*env)->Call${staticStr}ObjectMethod(env,$obj,classInfo->${toCMethodName(method)}${generateParametersName(method.parameters)});
@@ -127,11 +223,8 @@ object GenerateUtil {
           |if(result == NULL){
           |  lua_pushnil(L);
           |}else{
-          |  JavaArray* javaArray = lua_newuserdata(L,sizeof(JavaArray));
-          |  javaArray->id = luaJniCacheObject(env,result);
+          |  luaJniPushArray(L,env,result,${method.returnType.dimensions},"${method.returnType.name}",${generateArrayElementTypeCode(method.returnType.name)});
           |  (*env)->DeleteLocalRef(env,result);
-          |  javaArray->elementType = ${generateArrayElementTypeCode(method.returnType.name)};
-          |  luaL_setmetatable(L,"JavaArray");
           |}
       """.trimMargin()
     }
@@ -209,16 +302,24 @@ object GenerateUtil {
       "java.lang.Long" -> wrapperCode("long","integer")
       "java.lang.Float" -> wrapperCode("float","number")
       "java.lang.Double" -> wrapperCode("double","number")
+      in enumTypes -> """
+          |jobject result = (*env)->Call${staticStr}ObjectMethod(env,$obj,classInfo->${toCMethodName(method)}${generateParametersName(method.parameters)});
+          |${java2luaException(context)}
+          |int pushed = luaJniPushEnum(L,env,&${enumSymbol(method.returnType.name)},result);
+          |if(result) (*env)->DeleteLocalRef(env,result);
+          |if(!pushed){
+          |${generateReleaseContextCode(context).mIndent(2)}
+          |  lua_error(L);
+          |}
+        """.trimMargin()
       else -> """
           |jobject result = (*env)->Call${staticStr}ObjectMethod(env,$obj,classInfo->${toCMethodName(method)}${generateParametersName(method.parameters)});
           |${java2luaException(context)}
           |if(result == NULL){
           |  lua_pushnil(L);
           |}else{
-          |  JavaObject* javaObject = lua_newuserdata(L,sizeof(JavaObject));
-          |  javaObject->id = luaJniCacheObject(env,result);
+          |  luaJniNewObject(L,env,result,"${method.returnType.name}");
           |  (*env)->DeleteLocalRef(env,result);
-          |  luaL_setmetatable(L,"${method.returnType.name}");
           |}
         """.trimMargin()
     }
@@ -275,7 +376,7 @@ object GenerateUtil {
     return "($parameters)$returnType"
   }
 
-  private fun jniParameterType(type: CommonType):String{
+  fun jniParameterType(type: CommonType):String{
     val base = when(type.name){
       "void" -> "V"
       "boolean" -> "Z"
@@ -297,7 +398,7 @@ object GenerateUtil {
     return name.substring(name.lastIndexOf(lastStr)+1)
   }
 
-  fun headerCode(metaData:MetaData):String{
+  fun headerCode(metaData:MetaData,declarations:String = ""):String{
     val defineH = "${metaData.fileName()}_h".uppercase()
     val code = """
     |#ifndef $defineH
@@ -307,7 +408,7 @@ object GenerateUtil {
     |#endif
     |#include<jni.h>
     |int register_${metaData.injectToLuaMethodName()}(JNIEnv*env);
-    |int unregister_${metaData.injectToLuaMethodName()}(JNIEnv*env);
+    |int unregister_${metaData.injectToLuaMethodName()}(JNIEnv*env);${if(declarations.isEmpty()) "" else "\n$declarations"}
     |#ifdef __cplusplus
     |}
     |#endif
@@ -339,23 +440,39 @@ object GenerateUtil {
 
     }
 
+    val generateUserdataTypeCheck = {metaName:String,message:String->
+      """
+        |if(!lua_isnil(L,$index) && luaL_testudata(L,$index,"$metaName") == NULL){
+        |${generateReleaseContextCode(context).mIndent(2)}
+        |  luaL_error(L,"Parameter $index must be a $message");
+        |}
+      """.trimMargin()
+    }
+
     if(type.dimensions > 0){
-      val jniObjectName = jniObjectParameterName(parameterName)
+      return generateUserdataTypeCheck("JavaArray","JavaArray")
+    }
+    if(isEnumType(type)){
       return """
-          |JavaArray* $jniObjectName = NULL;
-          |if(!lua_isnil(L,$index)){
-          |  $jniObjectName = (JavaArray*)luaL_testudata(L,$index,"JavaArray");
-          |  if($jniObjectName  == NULL){
-          |${generateReleaseContextCode(context).mIndent(4)}
-          |    luaL_error(L,"Parameter $index must be a JavaArray");
-          |  }
-          |}
-        """.trimMargin()
+        |if(!lua_isnil(L,$index) && luaJniEnumIndex(L,$index,&${enumSymbol(type.name)}) < 0){
+        |${generateReleaseContextCode(context).mIndent(2)}
+        |  luaL_error(L,"Parameter $index must be a constant of ${type.name}");
+        |}
+      """.trimMargin()
+    }
+    if(type.callback != null){
+      return """
+        |if(!lua_isnil(L,$index) && !lua_isfunction(L,$index) && luaL_testudata(L,$index,"${type.name}") == NULL){
+        |${generateReleaseContextCode(context).mIndent(2)}
+        |  luaL_error(L,"Parameter $index must be a function or ${type.name}");
+        |}
+      """.trimMargin()
     }
 
     return when(type.name){
       "boolean" -> generateSimpleTypeCheck("boolean")
       "byte" -> generateSimpleTypeCheck("integer")
+      "char" -> generateSimpleTypeCheck("integer")
       "short" -> generateSimpleTypeCheck("integer")
       "int" -> generateSimpleTypeCheck("integer")
       "long" -> generateSimpleTypeCheck("integer")
@@ -363,6 +480,7 @@ object GenerateUtil {
       "double" -> generateSimpleTypeCheck("number")
       "java.lang.Boolean"-> generateWrapperTypeCheck("boolean")
       "java.lang.Byte" -> generateWrapperTypeCheck("integer")
+      "java.lang.Character" -> generateWrapperTypeCheck("integer")
       "java.lang.Short" -> generateWrapperTypeCheck("integer")
       "java.lang.Integer" -> generateWrapperTypeCheck("integer")
       "java.lang.Long" -> generateWrapperTypeCheck("integer")
@@ -374,28 +492,19 @@ object GenerateUtil {
           |  luaL_error(L,"Parameter $index must be a string");
           |}
         """.trimMargin()
-      else ->{
-        val jniObjectName = jniObjectParameterName(parameterName)
-        """
-          |JavaObject* $jniObjectName = NULL;
-          |if(!lua_isnil(L,$index)){
-          |  $jniObjectName = (JavaObject*)luaL_testudata(L,$index,"${type.name}");
-          |  if($jniObjectName  == NULL){
-          |${generateReleaseContextCode(context).mIndent(4)}
-          |    luaL_error(L,"Parameter $index must be a ${type.name}");
-          |  }
-          |}
-        """.trimMargin()
-      }
-
+      else -> generateUserdataTypeCheck(type.name,type.name)
     }
   }
   fun parameterCheckTypeCode(parameter:CommonParameter,
                                      context: GeneratorContext, index:Int):String{
     return parameterCheckTypeCode(parameter.name,parameter.type,context,index)
   }
+  //the type of parameter must have been checked by parameterCheckTypeCode or isParameterTypeCode
   fun parameterInitCode(parameterName: String,type:CommonType,
-                                context: GeneratorContext,index:Int,checkJniObjectParameter:Boolean = false):String{
+                                context: GeneratorContext,index:Int):String{
+    if(type.dimensions > 0) return userdataParamInit(parameterName,"JavaArray",index)
+    if(type.callback != null) return callbackParamInit(parameterName,type,context,index)
+    if(isEnumType(type)) return enumParamInit(parameterName,type,context,index)
     val simpleParamInit = { name:String->
       val jniType = GenerateUtil.toJniTypeName(type.name)
       val paramName = toCParameterName(parameterName)
@@ -419,6 +528,7 @@ object GenerateUtil {
     return when(type.name){
       "boolean" -> simpleParamInit("boolean")
       "byte" -> simpleParamInit("integer")
+      "char" -> simpleParamInit("integer")
       "short" -> simpleParamInit("integer")
       "int" -> simpleParamInit("integer")
       "long" -> simpleParamInit("integer")
@@ -447,35 +557,87 @@ object GenerateUtil {
       "java.lang.Long" -> wrapParamInit("long","integer")
       "java.lang.Float" -> wrapParamInit("float","number")
       "java.lang.Double" -> wrapParamInit("double","number")
-      else -> {
-        val paramName = toCParameterName(parameterName)
-        val jniType = GenerateUtil.toJniTypeName(type.name)
-        val jniParameter = jniObjectParameterName(parameterName)
-        val checkJNIObjectCode = if(checkJniObjectParameter)"""
-            |$jniParameter = NULL;
-            |if(!lua_isnoneornil(L,$index)){
-            |  $jniParameter = (JavaObject*)luaL_testudata(L,$index,"${type.name}");
-            |  if($jniParameter == NULL){
-            |${generateReleaseContextCode(context).mIndent(4)}
-            |    luaL_error(L,"Parameter $index must be a ${type.name}");
-            |  }
-            |}
-          """.trimMargin() else ""
-        context.addPutBackObject(paramName)
-        """
-            |$jniType $paramName = NULL;
-            |$checkJNIObjectCode
-            |if($jniParameter != NULL){
-            |  $paramName = luaJniTakeObject($jniParameter->id);
-            |}
-          """.trimMargin()
-      }
+      else -> userdataParamInit(parameterName,"JavaObject",index)
     }
   }
 
-  fun parametersInitCode(method: CommonMethod, context: GeneratorContext,indexShift:Int=2,checkJniObjectParameter: Boolean=false):String{
+  private fun userdataParamInit(parameterName: String,userdataType:String,index:Int):String{
+    val paramName = toCParameterName(parameterName)
+    return """
+      |jobject $paramName = NULL;
+      |if(!lua_isnoneornil(L,$index)){
+      |  $paramName = luaJniTakeObject(env,(($userdataType*)lua_touserdata(L,$index))->id);
+      |}
+    """.trimMargin()
+  }
+
+  //enum values are global refs held by the generated LuaJniEnum, they are not released
+  private fun enumParamInit(parameterName: String,type:CommonType,
+                            context: GeneratorContext,index:Int):String{
+    val paramName = toCParameterName(parameterName)
+    val symbol = enumSymbol(type.name)
+    return """
+      |jobject $paramName = NULL;
+      |if(!lua_isnoneornil(L,$index)){
+      |  int ordinal_$paramName = luaJniEnumIndex(L,$index,&$symbol);
+      |  if(ordinal_$paramName < 0){
+      |${generateReleaseContextCode(context).mIndent(4)}
+      |    luaL_error(L,"Parameter $index must be a constant of ${type.name}");
+      |  }
+      |  $paramName = $symbol.values[ordinal_$paramName];
+      |}
+    """.trimMargin()
+  }
+
+  private fun callbackParamInit(parameterName: String,type:CommonType,
+                                context: GeneratorContext,index:Int):String{
+    val paramName = toCParameterName(parameterName)
+    val callbackName = "luaCallback_$paramName"
+    context.addDeleteLocalRef(callbackName)
+    return """
+      |jobject $callbackName = NULL;
+      |jobject $paramName = NULL;
+      |if(lua_isfunction(L,$index)){
+      |  $callbackName = ${newCallbackFunctionName(type.callback!!)}(L,env,$index);
+      |  if(luaJniCatchJavaException(L,env)){
+      |${generateReleaseContextCode(context).mIndent(4)}
+      |    lua_error(L);
+      |  }
+      |  $paramName = $callbackName;
+      |}else if(!lua_isnoneornil(L,$index)){
+      |  $paramName = luaJniTakeObject(env,((JavaObject*)lua_touserdata(L,$index))->id);
+      |}
+    """.trimMargin()
+  }
+
+  fun newCallbackFunctionName(callback:CommonCallback):String{
+    return "luaJniNew_${callbackFileName(callback)}"
+  }
+
+  fun callbackFileName(callback:CommonCallback):String{
+    return callback.proxyClassName().replace(".","_")
+  }
+
+  fun callbackIncludeCode(methods:List<CommonMethod>,fields:List<CommonField> = emptyList()):String{
+    return (methods.flatMap { method -> method.parameters.map { it.type } } + fields.map { it.type })
+      .mapNotNull { it.callback }
+      .distinct()
+      .joinToString("\n") { "#include \"${callbackFileName(it)}.h\"" }
+  }
+
+  fun enumIncludeCode(methods:List<CommonMethod>,fields:List<CommonField> = emptyList()):String{
+    return (methods.flatMap { method ->
+      method.parameters.map { it.type } + method.returnType + method.unpackFields.orEmpty().map { it.type }
+    } + fields.map { it.type })
+      .filter { isEnumType(it) }
+      .map { it.name }
+      .distinct()
+      .joinToString("\n") { "#include \"${it.replace(".","_").replace("$","__")}.h\"" }
+  }
+
+  fun parametersInitCode(method: CommonMethod, context: GeneratorContext,indexShift:Int=2):String{
     return method.parameters.withIndex().joinToString("\n"){ (index,parameter) ->
-      parameterInitCode(parameter.name,parameter.type,context,index+indexShift,checkJniObjectParameter)
+      parameterInitCode(parameter.name,parameter.type,context,index+indexShift)
     }
   }
   fun parametersCheckCode(method:CommonMethod,context: GeneratorContext,indexOrigin:Int=2):String{
@@ -484,9 +646,6 @@ object GenerateUtil {
         parameterCheckTypeCode(parameter,context,index+indexOrigin)
       }
   }
-  private fun jniObjectParameterName(parameterName:String):String {
-    return "jniObj_${parameterName}"
-  }
 
   fun methodCallName(name:String):String{
     return "method_${name}"
@@ -578,7 +737,54 @@ object GenerateUtil {
     }
   }
 
-  fun unpackReturnCode(unpack:Array<String>?):String{
+  fun unpackFieldName(method:CommonMethod,index:Int):String{
+    return "${toCMethodName(method)}_unpack_$index"
+  }
+
+  fun unpackFieldsDeclareCode(methods:List<CommonMethod>):String{
+    return methods.filter { it.unpackFields != null }.joinToString("\n") { method ->
+      method.unpackFields!!.indices.joinToString("\n") { "jfieldID ${unpackFieldName(method,it)};" }
+    }
+  }
+
+  //the unpacked fields are read from the returned class, which is not necessarily bound to lua,
+  //a missing class or field fails the registration, clazz and classInfo must not hold references yet
+  fun unpackFieldIdCode(methods:List<CommonMethod>):String{
+    val failCode = { member:String, releaseUnpackClass:Boolean ->
+      """
+        |luaJniRegisterFailed(env,classInfo->name,"$member");
+        |${if(releaseUnpackClass) "(*env)->DeleteLocalRef(env,unpackClass);" else ""}
+        |(*env)->DeleteLocalRef(env,clazz);
+        |free(classInfo);
+        |return 0;
+      """.trimMargin()
+    }
+    return methods.filter { it.unpackFields != null }.joinToString("\n") { method ->
+      val classPath = method.returnType.name.replace(".","/")
+      """
+        |{
+        |  jclass unpackClass = (*env)->FindClass(env,"$classPath");
+        |  if(unpackClass == NULL){
+        |${failCode(classPath,false).mIndent(4)}
+        |  }
+        |${method.unpackFields!!.withIndex().joinToString("\n") { (index,field) ->
+          """
+            |classInfo->${unpackFieldName(method,index)} = (*env)->GetFieldID(env,unpackClass,"${field.name}","${jniParameterType(field.type)}");
+            |if(classInfo->${unpackFieldName(method,index)} == NULL){
+            |${failCode("$classPath.${field.name}",true).mIndent(2)}
+            |}
+          """.trimMargin()
+        }.mIndent(2)}
+        |  (*env)->DeleteLocalRef(env,unpackClass);
+        |}
+      """.trimMargin()
+    }
+  }
+
+  //unpackFields are pushed by callMethodCode, otherwise the keys are read from the returned userdata
+  fun unpackReturnCode(method:CommonMethod):String{
+    method.unpackFields?.let { return "return ${it.size};" }
+    val unpack = method.unpack
     return if(unpack.isNullOrEmpty()) "return 1;" else """
       |${unpack.withIndex().joinToString("\n") {(index,key)-> "lua_getfield(L,${-1-index},\"${key}\");" }}
       |return ${unpack.size};
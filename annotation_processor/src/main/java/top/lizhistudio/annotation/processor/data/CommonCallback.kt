@@ -0,0 +1,17 @@
+package top.lizhistudio.annotation.processor.data
+
+data class CommonCallback(val interfaceName:String,
+                          val sourceName:String,
+                          val typeArguments:List<String>,
+                          val methodName:String,
+                          val returnType:CommonType,
+                          val parameters:List<CommonType>){
+  fun proxyClassName():String{
+    val key = (listOf(interfaceName) + typeArguments).joinToString("_")
+    return "$PROXY_PACKAGE.LuaCallback_${key.replace(Regex("[^A-Za-z0-9]"),"_")}"
+  }
+
+  companion object{
+    const val PROXY_PACKAGE = "top.lizhistudio.luajni.generated"
+  }
+}
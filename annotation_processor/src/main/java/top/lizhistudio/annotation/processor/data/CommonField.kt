@@ -4,7 +4,9 @@ data class CommonField(val name:String ,
                        val type:CommonType,
                        val readonly:Boolean = false,
                        val static:Boolean = false,
-                       val alias:String?=null)
+                       val alias:String?=null,
+                       val constantValue:Any? = null,
+                       val cached:Boolean = false)
 
 fun CommonField.indexName():String{
   return this.alias ?: this.name
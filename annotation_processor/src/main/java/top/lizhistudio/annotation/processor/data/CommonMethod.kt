@@ -8,7 +8,9 @@ data class CommonMethod(val name:String,
                         val isStatic:Boolean = false,
                         val alias:String?=null,
                         val unpack:Array<String>? = null,
-                        var order:Int?=null) {
+                        var order:Int?=null,
+                        val cached:Boolean = false,
+                        val unpackFields:List<CommonField>? = null) {
   override fun equals(other: Any?): Boolean {
     if (this === other) return true
     if (javaClass != other?.javaClass) return false
@@ -22,6 +24,7 @@ data class CommonMethod(val name:String,
     if (isStatic != other.isStatic) return false
     if (alias != other.alias) return false
     if (order != other.order) return false
+    if (cached != other.cached) return false
 
     return true
   }
@@ -34,6 +37,7 @@ data class CommonMethod(val name:String,
     result = 31 * result + isStatic.hashCode()
     result = 31 * result + (alias?.hashCode() ?: 0)
     result = 31 * result + (order ?: 0)
+    result = 31 * result + cached.hashCode()
     return result
   }
 }
@@ -1,6 +1,6 @@
 package top.lizhistudio.annotation.processor.data
 
-data class CommonType(val name:String,val dimensions :Int = 0){
+data class CommonType(val name:String,val dimensions :Int = 0,val callback:CommonCallback? = null){
   companion object {
     private val BOOLEAN = CommonType("boolean")
     private val BYTE = CommonType("byte")
@@ -2,8 +2,9 @@ package top.lizhistudio.annotation.processor.data
 
 
 
-data class GeneratorContext(val needRelease:MutableList<String> = mutableListOf()){
-  constructor(s:GeneratorContext):this(s.needRelease.toMutableList())
+data class GeneratorContext(val needRelease:MutableList<String> = mutableListOf(),
+                            var localFrame:Boolean = false){
+  constructor(s:GeneratorContext):this(s.needRelease.toMutableList(),s.localFrame)
   fun clone():GeneratorContext{
     return GeneratorContext(this)
   }
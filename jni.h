@@ -0,0 +1,186 @@
+#ifndef STUB_JNI_H
+#define STUB_JNI_H
+#include <stdint.h>
+#include <stdarg.h>
+typedef uint8_t jboolean; typedef int8_t jbyte; typedef uint16_t jchar; typedef int16_t jshort;
+typedef int32_t jint; typedef int64_t jlong; typedef float jfloat; typedef double jdouble; typedef jint jsize;
+struct _jobject; typedef struct _jobject* jobject;
+typedef jobject jclass, jstring, jarray, jobjectArray, jbooleanArray, jbyteArray, jcharArray, jshortArray,
+ jintArray, jlongArray, jfloatArray, jdoubleArray, jthrowable, jweak;
+struct _jfieldID; typedef struct _jfieldID* jfieldID; struct _jmethodID; typedef struct _jmethodID* jmethodID;
+typedef union jvalue { jboolean z; jbyte b; jchar c; jshort s; jint i; jlong j; jfloat f; jdouble d; jobject l; } jvalue;
+typedef struct { const char* name; const char* signature; void* fnPtr; } JNINativeMethod;
+#define JNI_FALSE 0
+#define JNI_TRUE 1
+#define JNI_OK 0
+#define JNI_ERR (-1)
+#define JNI_EDETACHED (-2)
+#define JNI_VERSION_1_6 0x00010006
+#define JNI_ABORT 2
+#define JNIEXPORT __attribute__ ((visibility ("default")))
+#define JNICALL
+struct JNINativeInterface; typedef const struct JNINativeInterface* JNIEnv;
+struct JNIInvokeInterface; typedef const struct JNIInvokeInterface* JavaVM;
+typedef struct JavaVMAttachArgs { jint version; const char* name; jobject group; } JavaVMAttachArgs;
+struct JNIInvokeInterface { void* r0; void* r1; void* r2;
+ jint (*DestroyJavaVM)(JavaVM*); jint (*AttachCurrentThread)(JavaVM*, JNIEnv**, void*);
+ jint (*DetachCurrentThread)(JavaVM*); jint (*GetEnv)(JavaVM*, void**, jint);
+ jint (*AttachCurrentThreadAsDaemon)(JavaVM*, JNIEnv**, void*); };
+struct JNINativeInterface {
+ jint (*GetVersion)(JNIEnv*);
+ jclass (*FindClass)(JNIEnv*, const char*);
+ jint (*Throw)(JNIEnv*, jthrowable);
+ jint (*ThrowNew)(JNIEnv *, jclass, const char *);
+ jthrowable (*ExceptionOccurred)(JNIEnv*);
+ void (*ExceptionDescribe)(JNIEnv*);
+ void (*ExceptionClear)(JNIEnv*);
+ jboolean (*ExceptionCheck)(JNIEnv*);
+ jint (*PushLocalFrame)(JNIEnv*, jint);
+ jobject (*PopLocalFrame)(JNIEnv*, jobject);
+ jint (*EnsureLocalCapacity)(JNIEnv*, jint);
+ jobject (*NewGlobalRef)(JNIEnv*, jobject);
+ void (*DeleteGlobalRef)(JNIEnv*, jobject);
+ void (*DeleteLocalRef)(JNIEnv*, jobject);
+ jobject (*NewLocalRef)(JNIEnv*, jobject);
+ jweak (*NewWeakGlobalRef)(JNIEnv*, jobject);
+ void (*DeleteWeakGlobalRef)(JNIEnv*, jweak);
+ jboolean (*IsSameObject)(JNIEnv*, jobject, jobject);
+ jboolean (*IsInstanceOf)(JNIEnv*, jobject, jclass);
+ jclass (*GetObjectClass)(JNIEnv*, jobject);
+ jclass (*GetSuperclass)(JNIEnv*, jclass);
+ jobject (*AllocObject)(JNIEnv*, jclass);
+ jobject (*NewObject)(JNIEnv*, jclass, jmethodID, ...);
+ jobject (*NewObjectA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jmethodID (*GetMethodID)(JNIEnv*, jclass, const char*, const char*);
+ jmethodID (*GetStaticMethodID)(JNIEnv*, jclass, const char*, const char*);
+ jfieldID (*GetFieldID)(JNIEnv*, jclass, const char*, const char*);
+ jfieldID (*GetStaticFieldID)(JNIEnv*, jclass, const char*, const char*);
+ jstring (*NewStringUTF)(JNIEnv*, const char*);
+ jstring (*NewString)(JNIEnv*, const jchar*, jsize);
+ jsize (*GetStringUTFLength)(JNIEnv*, jstring);
+ jsize (*GetStringLength)(JNIEnv*, jstring);
+ void (*GetStringUTFRegion)(JNIEnv*, jstring, jsize, jsize, char*);
+ const char* (*GetStringUTFChars)(JNIEnv*, jstring, jboolean*);
+ void (*ReleaseStringUTFChars)(JNIEnv*, jstring, const char*);
+ jsize (*GetArrayLength)(JNIEnv*, jarray);
+ jobjectArray (*NewObjectArray)(JNIEnv*, jsize, jclass, jobject);
+ jobject (*GetObjectArrayElement)(JNIEnv*, jobjectArray, jsize);
+ void (*SetObjectArrayElement)(JNIEnv*, jobjectArray, jsize, jobject);
+ void* (*GetPrimitiveArrayCritical)(JNIEnv*, jarray, jboolean*);
+ void (*ReleasePrimitiveArrayCritical)(JNIEnv*, jarray, void*, jint);
+ jint (*RegisterNatives)(JNIEnv*, jclass, const JNINativeMethod*, jint);
+ jint (*UnregisterNatives)(JNIEnv*, jclass);
+ jint (*GetJavaVM)(JNIEnv*, JavaVM**);
+ jlong (*GetDirectBufferCapacity)(JNIEnv*, jobject);
+ jobject (*CallObjectMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jobject (*CallObjectMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jobject (*CallStaticObjectMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jobject (*CallStaticObjectMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jobject (*CallNonvirtualObjectMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jobject (*GetObjectField)(JNIEnv*, jobject, jfieldID);
+ void (*SetObjectField)(JNIEnv*, jobject, jfieldID, jobject);
+ jobject (*GetStaticObjectField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticObjectField)(JNIEnv*, jclass, jfieldID, jobject);
+ jboolean (*CallBooleanMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jboolean (*CallBooleanMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jboolean (*CallStaticBooleanMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jboolean (*CallStaticBooleanMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jboolean (*CallNonvirtualBooleanMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jboolean (*GetBooleanField)(JNIEnv*, jobject, jfieldID);
+ void (*SetBooleanField)(JNIEnv*, jobject, jfieldID, jboolean);
+ jboolean (*GetStaticBooleanField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticBooleanField)(JNIEnv*, jclass, jfieldID, jboolean);
+ jbooleanArray (*NewBooleanArray)(JNIEnv*, jsize);
+ void (*GetBooleanArrayRegion)(JNIEnv*, jbooleanArray, jsize, jsize, jboolean*);
+ void (*SetBooleanArrayRegion)(JNIEnv*, jbooleanArray, jsize, jsize, const jboolean*);
+ jbyte (*CallByteMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jbyte (*CallByteMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jbyte (*CallStaticByteMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jbyte (*CallStaticByteMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jbyte (*CallNonvirtualByteMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jbyte (*GetByteField)(JNIEnv*, jobject, jfieldID);
+ void (*SetByteField)(JNIEnv*, jobject, jfieldID, jbyte);
+ jbyte (*GetStaticByteField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticByteField)(JNIEnv*, jclass, jfieldID, jbyte);
+ jbyteArray (*NewByteArray)(JNIEnv*, jsize);
+ void (*GetByteArrayRegion)(JNIEnv*, jbyteArray, jsize, jsize, jbyte*);
+ void (*SetByteArrayRegion)(JNIEnv*, jbyteArray, jsize, jsize, const jbyte*);
+ jchar (*CallCharMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jchar (*CallCharMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jchar (*CallStaticCharMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jchar (*CallStaticCharMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jchar (*CallNonvirtualCharMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jchar (*GetCharField)(JNIEnv*, jobject, jfieldID);
+ void (*SetCharField)(JNIEnv*, jobject, jfieldID, jchar);
+ jchar (*GetStaticCharField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticCharField)(JNIEnv*, jclass, jfieldID, jchar);
+ jcharArray (*NewCharArray)(JNIEnv*, jsize);
+ void (*GetCharArrayRegion)(JNIEnv*, jcharArray, jsize, jsize, jchar*);
+ void (*SetCharArrayRegion)(JNIEnv*, jcharArray, jsize, jsize, const jchar*);
+ jshort (*CallShortMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jshort (*CallShortMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jshort (*CallStaticShortMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jshort (*CallStaticShortMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jshort (*CallNonvirtualShortMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jshort (*GetShortField)(JNIEnv*, jobject, jfieldID);
+ void (*SetShortField)(JNIEnv*, jobject, jfieldID, jshort);
+ jshort (*GetStaticShortField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticShortField)(JNIEnv*, jclass, jfieldID, jshort);
+ jshortArray (*NewShortArray)(JNIEnv*, jsize);
+ void (*GetShortArrayRegion)(JNIEnv*, jshortArray, jsize, jsize, jshort*);
+ void (*SetShortArrayRegion)(JNIEnv*, jshortArray, jsize, jsize, const jshort*);
+ jint (*CallIntMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jint (*CallIntMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jint (*CallStaticIntMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jint (*CallStaticIntMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jint (*CallNonvirtualIntMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jint (*GetIntField)(JNIEnv*, jobject, jfieldID);
+ void (*SetIntField)(JNIEnv*, jobject, jfieldID, jint);
+ jint (*GetStaticIntField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticIntField)(JNIEnv*, jclass, jfieldID, jint);
+ jintArray (*NewIntArray)(JNIEnv*, jsize);
+ void (*GetIntArrayRegion)(JNIEnv*, jintArray, jsize, jsize, jint*);
+ void (*SetIntArrayRegion)(JNIEnv*, jintArray, jsize, jsize, const jint*);
+ jlong (*CallLongMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jlong (*CallLongMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jlong (*CallStaticLongMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jlong (*CallStaticLongMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jlong (*CallNonvirtualLongMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jlong (*GetLongField)(JNIEnv*, jobject, jfieldID);
+ void (*SetLongField)(JNIEnv*, jobject, jfieldID, jlong);
+ jlong (*GetStaticLongField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticLongField)(JNIEnv*, jclass, jfieldID, jlong);
+ jlongArray (*NewLongArray)(JNIEnv*, jsize);
+ void (*GetLongArrayRegion)(JNIEnv*, jlongArray, jsize, jsize, jlong*);
+ void (*SetLongArrayRegion)(JNIEnv*, jlongArray, jsize, jsize, const jlong*);
+ jfloat (*CallFloatMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jfloat (*CallFloatMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jfloat (*CallStaticFloatMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jfloat (*CallStaticFloatMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jfloat (*CallNonvirtualFloatMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jfloat (*GetFloatField)(JNIEnv*, jobject, jfieldID);
+ void (*SetFloatField)(JNIEnv*, jobject, jfieldID, jfloat);
+ jfloat (*GetStaticFloatField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticFloatField)(JNIEnv*, jclass, jfieldID, jfloat);
+ jfloatArray (*NewFloatArray)(JNIEnv*, jsize);
+ void (*GetFloatArrayRegion)(JNIEnv*, jfloatArray, jsize, jsize, jfloat*);
+ void (*SetFloatArrayRegion)(JNIEnv*, jfloatArray, jsize, jsize, const jfloat*);
+ jdouble (*CallDoubleMethod)(JNIEnv*, jobject, jmethodID, ...);
+ jdouble (*CallDoubleMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ jdouble (*CallStaticDoubleMethod)(JNIEnv*, jclass, jmethodID, ...);
+ jdouble (*CallStaticDoubleMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ jdouble (*CallNonvirtualDoubleMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+ jdouble (*GetDoubleField)(JNIEnv*, jobject, jfieldID);
+ void (*SetDoubleField)(JNIEnv*, jobject, jfieldID, jdouble);
+ jdouble (*GetStaticDoubleField)(JNIEnv*, jclass, jfieldID);
+ void (*SetStaticDoubleField)(JNIEnv*, jclass, jfieldID, jdouble);
+ jdoubleArray (*NewDoubleArray)(JNIEnv*, jsize);
+ void (*GetDoubleArrayRegion)(JNIEnv*, jdoubleArray, jsize, jsize, jdouble*);
+ void (*SetDoubleArrayRegion)(JNIEnv*, jdoubleArray, jsize, jsize, const jdouble*);
+ void (*CallVoidMethod)(JNIEnv*, jobject, jmethodID, ...);
+ void (*CallVoidMethodA)(JNIEnv*, jobject, jmethodID, const jvalue*);
+ void (*CallStaticVoidMethod)(JNIEnv*, jclass, jmethodID, ...);
+ void (*CallStaticVoidMethodA)(JNIEnv*, jclass, jmethodID, const jvalue*);
+ void (*CallNonvirtualVoidMethodA)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*);
+};
+#endif
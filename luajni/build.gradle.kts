@@ -47,6 +47,13 @@ android {
   ndkVersion ="25.2.9519653"
 }
 
+//-Pluajni.stats=true compiles per-binding call counters into the generated code
+kapt {
+  arguments {
+    arg("luajni.stats", (findProperty("luajni.stats") as String?) ?: "false")
+  }
+}
+
 afterEvaluate {
   tasks.withType<Task>().configureEach {
     if (name.startsWith("configureCMake") ) {
@@ -6,15 +6,27 @@ import org.junit.Test
 import org.junit.runner.RunWith
 
 import org.junit.Assert.*
+import top.lizhistudio.luajni.core.LuaAbortError
+import top.lizhistudio.luajni.core.LuaBudget
 import top.lizhistudio.luajni.core.LuaError
+import top.lizhistudio.luajni.core.LuaGcPolicy
 
 import top.lizhistudio.luajni.core.LuaInterpreter
+import top.lizhistudio.luajni.test.BrokenBag
+import top.lizhistudio.luajni.test.BrokenList
+import top.lizhistudio.luajni.test.CallbackTest
+import top.lizhistudio.luajni.test.CompactTest
 import top.lizhistudio.luajni.test.CompanionObjectFunction
+import top.lizhistudio.luajni.test.Crossing
+import top.lizhistudio.luajni.test.Countdown
+import top.lizhistudio.luajni.test.ConstantTest
 import top.lizhistudio.luajni.test.InsideClass
+import top.lizhistudio.luajni.test.NameList
 import top.lizhistudio.luajni.test.SimpleEnumJava
 import top.lizhistudio.luajni.test.SimpleEnvironment
 import top.lizhistudio.luajni.test.SimpleFunction
 import top.lizhistudio.luajni.test.SimpleTest
+import top.lizhistudio.luajni.test.TrafficLight
 import top.lizhistudio.luajni.test.WrapperTest
 
 
@@ -194,4 +206,416 @@ class LuaJniTest {
     lua.execute(code)
     lua.destroy()
   }
+
+  @Test
+  fun testCallback() {
+    val lua = LuaInterpreter()
+    lua.register(CallbackTest::class.java)
+    val code = """
+      local count = 0
+      CallbackTest:run(function() count = count + 1 end)
+      assert(count == 1)
+      assert(CallbackTest:map(2, function(v) return v * 10 end) == 20)
+      local message
+      CallbackTest:listen(function(m) message = m end)
+      assert(message == "Hello")
+      local f = function() count = count + 1 end
+      assert(CallbackTest:same(f, f))
+      assert(not CallbackTest:same(f, function() end))
+      CallbackTest:keep(f)
+      assert(CallbackTest:closeKept())
+      CallbackTest:run(f)
+      assert(count == 2)
+      --proxies made inside a coroutine run on the main thread, after it finished or while it is suspended
+      local finished = coroutine.wrap(function() CallbackTest:keep(function() count = count + 1 end) end)
+      finished()
+      finished = nil
+      collectgarbage()
+      CallbackTest:runKept()
+      assert(count == 3)
+      local suspended = coroutine.create(function()
+        CallbackTest:keep(function() count = count + 1 end)
+        coroutine.yield()
+      end)
+      coroutine.resume(suspended)
+      CallbackTest:runKept()
+      assert(count == 4)
+      assert(CallbackTest:runKeptElsewhere())
+      assert(count == 4)
+    """.trimIndent()
+    lua.execute(code)
+    lua.destroy()
+  }
+
+  @Test
+  fun testCompact() {
+    val lua = LuaInterpreter()
+    lua.register(CompactTest::class.java)
+    val code = """
+      assert(CompactTest.oneValue == 1)
+      CompactTest.oneValue = 5
+      assert(CompactTest:add(2) == 7)
+      assert(CompactTest:add(0.5) == 5.5)
+      assert(CompactTest:concat("-", nil) == "compact-0")
+      CompactTest.name = "lua"
+      assert(CompactTest:concat("+", 3) == "lua+3")
+      assert(CompactTest:map(4, function(v) return v * v end) == 16)
+      local one, name = CompactTest:pair(true)
+      assert(one == 5 and name == "lua")
+      one, name = CompactTest:pair(false)
+      assert(one == nil and name == nil)
+      assert(select("#", CompactTest:pair(false)) == 2)
+    """.trimIndent()
+    lua.execute(code)
+    lua.destroy()
+  }
+
+  @Test
+  fun testLocalReferenceStress() {
+    val lua = LuaInterpreter()
+    lua.register(
+      SimpleTest::class.java,
+      WrapperTest::class.java,
+      CompactTest::class.java)
+    val code = """
+      local obj = WrapperTest("Hello")
+      for i = 1, 200000 do
+        assert(obj:test(i) == i + 1)
+        obj.name = "name"
+        assert(obj.name == "name")
+        assert(CompactTest:concat("-", i) == CompactTest.name .. "-" .. i)
+        assert(not pcall(CompactTest.concat, CompactTest, 1, 2))
+      end
+    """.trimIndent()
+    lua.execute(code)
+    lua.destroy()
+  }
+
+  @Test
+  fun testConstantAndCachedField() {
+    val lua = LuaInterpreter()
+    lua.register(ConstantTest::class.java)
+    ConstantTest.reads = 0
+    val code = """
+      assert(ConstantTest.VERSION == ${ConstantTest.VERSION})
+      assert(ConstantTest.TITLE == 'say "hi"??')
+      assert(ConstantTest.RATIO == ${ConstantTest.RATIO})
+      assert(ConstantTest.name == "config")
+      for i = 1, 10 do
+        assert(ConstantTest.config == "config-1")
+      end
+    """.trimIndent()
+    lua.execute(code)
+    assertEquals(1, ConstantTest.reads)
+    lua.destroy()
+  }
+
+  @Test
+  fun testProfiler() {
+    val lua = LuaInterpreter()
+    lua.register(WrapperTest::class.java, CompactTest::class.java)
+    lua.startProfiler(100, 1)
+    val code = """
+      local function work(obj)
+        for i = 1, 20000 do
+          obj:test(i)
+          CompactTest:add(i)
+        end
+      end
+      work(WrapperTest("Hello"))
+    """.trimIndent()
+    lua.execute(code)
+    val samples = lua.stopProfiler().lines().filter { it.isNotEmpty() }
+    assertTrue(samples.isNotEmpty())
+    samples.forEach { assertTrue(it.substringAfterLast(' ').toLong() > 0) }
+    assertTrue(samples.any { it.contains("work@") && it.contains(";java:${WrapperTest::class.java.name}.test ") })
+    assertTrue(samples.any { it.contains(";java:${CompactTest::class.java.name}.add ") })
+    assertEquals("", lua.stopProfiler())
+    lua.destroy()
+  }
+
+  @Test
+  fun testStats() {
+    val lua = LuaInterpreter()
+    lua.register(WrapperTest::class.java)
+    val before = lua.stats()
+    lua.execute("""
+      objects = {}
+      for i = 1, 1000 do
+        local obj = WrapperTest("Hello")
+        obj:test(i)
+        objects[i] = obj
+      end
+    """.trimIndent())
+    val live = lua.stats()
+    assertTrue(live.globalRefs >= before.globalRefs + 1000)
+    assertTrue(live.luaHeapBytes > 0)
+    assertEquals(0, live.frameDepth)
+    lua.execute("objects = nil collectgarbage() collectgarbage()")
+    val collected = lua.stats()
+    assertTrue(collected.handlesCollected >= before.handlesCollected + 1000)
+    assertTrue(collected.globalRefs < live.globalRefs)
+    //only recorded when the bindings are generated with -Pluajni.stats=true
+    collected.bindings.find { it.className == WrapperTest::class.java.name && it.member == "test" }?.let {
+      assertTrue(it.calls >= 1000)
+      assertEquals(it.calls, it.histogram.sum())
+    }
+    lua.destroy()
+  }
+
+  @Test
+  fun testGcPressure() {
+    val lua = LuaInterpreter()
+    lua.register(WrapperTest::class.java)
+    lua.setGcPolicy(LuaGcPolicy(handleBytes = 1024, stepBytes = 64 * 1024, globalRefLimit = 10_000, generational = true))
+    assertTrue(lua.setSizeEstimate(WrapperTest::class.java, 4096))
+    assertFalse(lua.setSizeEstimate(SimpleTest::class.java, 4096))
+    val before = lua.stats().globalRefs
+    var peak = 0L
+    for (round in 1..10) {
+      lua.execute("""
+        for i = 1, 20000 do
+          local obj = WrapperTest("Hello")
+          obj:test(i)
+        end
+      """.trimIndent())
+      peak = maxOf(peak, lua.stats().globalRefs - before)
+    }
+    assertTrue("peak $peak", peak < 15_000)
+    //more handles held than the limit allows, the garbage around them is still collected
+    lua.execute("kept = {} for i = 1, 12000 do kept[i] = WrapperTest('Hello') end")
+    peak = 0L
+    for (round in 1..5) {
+      lua.execute("for i = 1, 20000 do WrapperTest('Hello'):test(i) end")
+      peak = maxOf(peak, lua.stats().globalRefs - before)
+    }
+    assertTrue("peak $peak", peak < 20_000)
+    lua.execute("kept = nil")
+    lua.destroy()
+  }
+
+  @Test
+  fun testLazyException(){
+    val lua = LuaInterpreter()
+    lua.register(SimpleFunction::class.java)
+    val code = """
+      local ok, e = pcall(find, "key")
+      assert(not ok)
+      return tostring(e) .. "|" .. e.message .. "|" .. e.stackTrace
+    """.trimIndent()
+    assertEquals("key", lua.execute("local ok, e = pcall(find, 'key') return e"))
+    lua.setLazyExceptions(true)
+    val result = lua.execute(code) as String
+    assertTrue(result.startsWith("key|key|java.util.NoSuchElementException: key"))
+    try {
+      lua.execute("find('missing')")
+      fail("Should throw exception")
+    } catch (e: LuaError) {
+      assertTrue(e.cause is NoSuchElementException)
+      assertEquals("missing", e.cause?.message)
+    }
+    lua.destroy()
+  }
+
+  @Test
+  fun testMatrix(){
+    val lua = LuaInterpreter()
+    val code = """
+      local m = BenchmarkTarget.matrix
+      assert(m[2][3] == 66)
+      assert(m:get(2, 3) == 66)
+      assert(#m:get(2) == 64)
+      m:set(2, 3, 7)
+      assert(m[2][3] == 7 and m:get(2, 3) == 7)
+      assert(rawequal(m[2], m[2]))
+      assert(not pcall(m.get, m, 65, 1))
+      assert(not pcall(m.set, m, 1, 1, "a"))
+    """.trimIndent()
+    lua.execute(code)
+    lua.destroy()
+  }
+
+  @Test
+  fun testParallel(){
+    val lua = LuaInterpreter()
+    lua.register(SimpleFunction::class.java)
+    val code = """
+      local items = {}
+      for i = 1, 1000 do items[i] = { value = i, name = "n" .. i } end
+      local results = luajni.parallel([[
+        return function(item, index)
+          return { add(item.value, index), item.name }
+        end
+      ]], items, { workers = 4 })
+      assert(#results == 1000)
+      for i = 1, 1000 do
+        assert(results[i][1] == i * 2 and results[i][2] == "n" .. i)
+      end
+      assert(not pcall(luajni.parallel, "return function(x) error('boom') end", { 1, 2, 3 }))
+      assert(not pcall(luajni.parallel, "return function(x) return x end", { print }))
+      return #luajni.parallel("return function(x) return x end", {})
+    """.trimIndent()
+    assertEquals(0L, lua.execute(code))
+    val runaway = "return luajni.parallel('return function(x) while true do end end', { 1, 2 }, { workers = 2 })"
+    assertEquals(LuaAbortError.DEADLINE, abortReason { lua.execute(runaway, LuaBudget(timeoutMillis = 50)) })
+    //about 400k instructions per item, each fits the budget but the four together do not
+    val bounded = "return #luajni.parallel('return function(x) local s = 0 for i = 1, 200000 do s = s + i end return s end', { 1, 2, 3, 4 }, { workers = 4 })"
+    assertEquals(LuaAbortError.INSTRUCTIONS, abortReason { lua.execute(bounded, LuaBudget(maxInstructions = 1_000_000)) })
+    assertEquals(4L, lua.execute(bounded, LuaBudget(maxInstructions = 10_000_000)))
+    assertEquals(2L, lua.execute("return #luajni.parallel('return function(x) return x end', { 1, 2 })"))
+    lua.destroy()
+  }
+
+  @Test
+  fun testIter(){
+    val lua = LuaInterpreter()
+    lua.register(NameList::class.java, Countdown::class.java, BrokenList::class.java, BrokenBag::class.java)
+    val code = """
+      local list = NameList()
+      for i = 1, 1000 do list:put("n" .. i) end
+      local count = 0
+      for i, v in luajni.iter(list, 64) do
+        assert(v == "n" .. i)
+        count = count + 1
+      end
+      assert(count == 1000)
+      local sum = 0
+      for i, v in luajni.iter(Countdown(10)) do sum = sum + v end
+      assert(sum == 55)
+      local ints = BenchmarkTarget.ints
+      sum = 0
+      for i, v in pairs(ints) do
+        assert(v == i - 1)
+        sum = sum + v
+      end
+      assert(sum == 1023 * 1024 // 2)
+      for i, row in pairs(BenchmarkTarget.matrix) do
+        assert(row[1] == (i - 1) * 64)
+      end
+      assert(not pcall(luajni.iter, 1))
+      local ok, e = pcall(luajni.iter, BrokenList())
+      assert(not ok and tostring(e):find("broken size"))
+      ok, e = pcall(luajni.iter, BrokenBag())
+      assert(not ok and tostring(e):find("broken size"))
+    """.trimIndent()
+    lua.execute(code)
+    lua.destroy()
+  }
+
+  @Test
+  fun testEnumClass(){
+    val lua = LuaInterpreter()
+    lua.register(TrafficLight::class.java, Crossing::class.java)
+    val code = """
+      assert(TrafficLight.RED == "RED")
+      local crossing = Crossing()
+      assert(crossing.light == TrafficLight.RED)
+      assert(crossing:next(TrafficLight.RED) == "YELLOW")
+      assert(crossing:next("GREEN") == TrafficLight.RED)
+      crossing.light = "GREEN"
+      assert(crossing.light == "GREEN")
+      assert(crossing:isStop(nil))
+      assert(not crossing:isStop("YELLOW"))
+      assert(not pcall(crossing.next, crossing, "BLUE"))
+      local light, seconds = crossing:phase()
+      assert(light == "GREEN" and seconds == 30)
+      return crossing:next(crossing.light)
+    """.trimIndent()
+    assertEquals(TrafficLight.RED.name, lua.execute(code))
+    lua.destroy()
+  }
+
+  @Test
+  fun testUnpackFields(){
+    val lua = LuaInterpreter()
+    lua.register(SimpleFunction::class.java)
+    val code = """
+      local x, y, w, h = bounds(5)
+      assert(x == 5 and y == 10 and w == 15 and h == 20)
+      x, y, w, h = bounds(0)
+      assert(x == nil and y == nil and w == nil and h == nil)
+      return select("#", bounds(1))
+    """.trimIndent()
+    assertEquals(4L, lua.execute(code))
+    lua.destroy()
+  }
+
+  private fun cancelLater(lua: LuaInterpreter, block: () -> Unit) {
+    val canceller = Thread {
+      Thread.sleep(100)
+      lua.cancel()
+    }
+    canceller.start()
+    try {
+      block()
+    } finally {
+      canceller.join()
+    }
+  }
+
+  private fun bestNanos(block: () -> Unit): Long {
+    var best = Long.MAX_VALUE
+    repeat(5) {
+      val start = System.nanoTime()
+      block()
+      best = minOf(best, System.nanoTime() - start)
+    }
+    return best
+  }
+
+  private fun abortReason(block: () -> Unit): Int {
+    try {
+      block()
+      fail("Should throw LuaAbortError")
+    } catch (e: LuaAbortError) {
+      return e.reason
+    }
+    return 0
+  }
+
+  @Test
+  fun testBudget(){
+    val lua = LuaInterpreter()
+    lua.register(CallbackTest::class.java)
+    val loop = "while true do end"
+    assertEquals(LuaAbortError.INSTRUCTIONS, abortReason { lua.execute(loop, LuaBudget(maxInstructions = 100_000)) })
+    val swallow = "while true do pcall(function() while true do end end) end"
+    assertEquals(LuaAbortError.INSTRUCTIONS, abortReason { lua.execute(swallow, LuaBudget(maxInstructions = 100_000)) })
+    assertEquals(LuaAbortError.DEADLINE, abortReason { lua.execute(loop, LuaBudget(timeoutMillis = 50)) })
+    assertEquals(2L, lua.execute("return 1 + 1"))
+    //an unbudgeted call has no hook, it sees the cancel at its next call into java
+    val bindingLoop = "while true do CallbackTest:map(1, function(v) return v end) end"
+    assertEquals(LuaAbortError.CANCELLED, abortReason { cancelLater(lua) { lua.execute(bindingLoop) } })
+    val watched = LuaBudget(timeoutMillis = 60_000)
+    assertEquals(LuaAbortError.CANCELLED, abortReason { cancelLater(lua) { lua.execute(loop, watched) } })
+    //coroutines created by an unbudgeted call get the hook when they are resumed
+    lua.execute("co = coroutine.wrap(function() while true do end end)")
+    assertEquals(LuaAbortError.INSTRUCTIONS, abortReason { lua.execute("co()", LuaBudget(maxInstructions = 100_000)) })
+    lua.execute("spin = coroutine.create(function() while true do end end)")
+    val resume = "local ok, e = coroutine.resume(spin) while true do end"
+    assertEquals(LuaAbortError.CANCELLED, abortReason { cancelLater(lua) { lua.execute(resume, watched) } })
+    lua.setCallBudget(LuaBudget(maxInstructions = 100_000))
+    val callback = "return CallbackTest:map(1, function(v) while true do end end)"
+    assertEquals(LuaAbortError.INSTRUCTIONS, abortReason { lua.execute(callback) })
+    lua.setCallBudget(LuaBudget.UNLIMITED)
+    assertEquals(3L, lua.execute("return CallbackTest:map(1, function(v) return v + 2 end)"))
+    lua.destroy()
+  }
+
+  @Test
+  fun testUnbudgetedCost(){
+    val lua = LuaInterpreter()
+    val hooked = "return debug.gethook() ~= nil or coroutine.wrap(function() return debug.gethook() ~= nil end)()"
+    val loop = "local n = 0 for i = 1, 2000000 do n = n + i end return n"
+    assertEquals(false, lua.execute(hooked))
+    val baseline = bestNanos { lua.execute(loop) }
+    assertEquals(true, lua.execute(hooked, LuaBudget(maxInstructions = Long.MAX_VALUE)))
+    val budgeted = bestNanos { lua.execute(loop, LuaBudget(timeoutMillis = 60_000)) }
+    lua.cancel()
+    //no hook is left behind by the budgeted calls or the dropped cancel
+    assertEquals(false, lua.execute(hooked))
+    val unbudgeted = bestNanos { lua.execute(loop) }
+    assertTrue("baseline $baseline unbudgeted $unbudgeted budgeted $budgeted", unbudgeted < baseline * 3 / 2)
+    lua.destroy()
+  }
 }
\ No newline at end of file
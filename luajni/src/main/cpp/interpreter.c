@@ -6,20 +6,17 @@
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
-#include <android/log.h>
 
 #include "mlog.h"
 #include "luajni.h"
 #include "lua_jni_extension.h"
 
-#define SET_ENV(env) (*(JNIEnv**)lua_getextraspace(L)) = env;
-#define GET_ENV() (*(JNIEnv**)lua_getextraspace(L))
+#define SET_ENV(env) luaJniSetEnv(L,env);
 
 JNIEXPORT jlong JNICALL
 Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_create(JNIEnv *env, jobject thiz) {
     lua_State *L =luaL_newstate();
     luaL_openlibs(L);
-    SET_ENV(env);
     luaJniInitLua(L,env);
     return (jlong) L;
 }
@@ -27,24 +24,30 @@ Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_create(JNIEnv *en
 JNIEXPORT void JNICALL
 Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_destroy(JNIEnv *env, jobject thiz,
                                                                    jlong native_ptr) {
-    lua_close((lua_State *) native_ptr);
+    luaJniCloseLua((lua_State *) native_ptr);
 }
 
 JNIEXPORT jobject JNICALL
 Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_execute(JNIEnv *env, jobject thiz,
                                                                    jlong native_ptr,
-                                                                   jstring script) {
+                                                                   jstring script,
+                                                                   jlong max_instructions,
+                                                                   jlong timeout_millis) {
     lua_State *L = (lua_State *) native_ptr;
     SET_ENV(env);
     const char *c_script = (*env)->GetStringUTFChars(env, script, 0);
+    int owner = luaJniBeginCall(L, max_instructions, timeout_millis);
+    int depth = luaJniLocalFrameDepth(L);
     int ret = luaL_dostring(L, c_script);
+    luaJniPopLocalFrames(L, env, depth);
     (*env)->ReleaseStringUTFChars(env, script, c_script);
     if (ret != LUA_OK) {
-        jclass clazz = (*env)->FindClass(env,"top/lizhistudio/luajni/core/LuaError");
-        (*env)->ThrowNew(env, clazz, lua_tostring(L, -1));
+        luaJniThrowLuaErrorAt(L, env, -1);
+        luaJniEndCall(L, owner);
         lua_settop(L,0);
         return NULL;
     }
+    luaJniEndCall(L, owner);
     int type = lua_type(L, -1);
     jobject result = NULL;
     switch (type) {
@@ -95,6 +98,130 @@ Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_register(JNIEnv *
     return r;
 }
 
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_startProfiler(JNIEnv *env, jobject thiz,
+                                                                         jlong native_ptr,
+                                                                         jint instruction_interval,
+                                                                         jint binding_interval) {
+    lua_State *L = (lua_State *) native_ptr;
+    SET_ENV(env);
+    luaJniStartProfiler(L, instruction_interval, binding_interval);
+}
+
+JNIEXPORT jstring JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_stopProfiler(JNIEnv *env, jobject thiz,
+                                                                        jlong native_ptr) {
+    lua_State *L = (lua_State *) native_ptr;
+    SET_ENV(env);
+    luaJniStopProfiler(L);
+    jstring result = (*env)->NewStringUTF(env, lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return result;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_gauges(JNIEnv *env, jobject thiz,
+                                                                  jlong native_ptr) {
+    lua_State *L = (lua_State *) native_ptr;
+    LuaJniGauges gauges;
+    luaJniGetGauges(L, &gauges);
+    jlong values[] = {gauges.globalRefs, gauges.handlesCreated, gauges.handlesCollected,
+                      gauges.luaHeapBytes, gauges.callbacks, gauges.frameDepth};
+    jsize count = sizeof(values) / sizeof(values[0]);
+    jlongArray result = (*env)->NewLongArray(env, count);
+    (*env)->SetLongArrayRegion(env, result, 0, count, values);
+    return result;
+}
+
+//names holds className and member of every binding, values holds the calls followed by the histogram
+JNIEXPORT jint JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_bindingStats(JNIEnv *env, jobject thiz,
+                                                                        jobjectArray names,
+                                                                        jlongArray values) {
+    jsize capacity = (*env)->GetArrayLength(env, names) / 2;
+    jint count = 0;
+    for (LuaJniBindingStats *stats = luaJniBindingStatsList(); stats && count < capacity; stats = stats->next) {
+        jstring className = (*env)->NewStringUTF(env, stats->className);
+        jstring member = (*env)->NewStringUTF(env, stats->member);
+        (*env)->SetObjectArrayElement(env, names, count * 2, className);
+        (*env)->SetObjectArrayElement(env, names, count * 2 + 1, member);
+        (*env)->DeleteLocalRef(env, className);
+        (*env)->DeleteLocalRef(env, member);
+        jlong row[LUA_JNI_STATS_BUCKETS + 1];
+        row[0] = (jlong) __atomic_load_n(&stats->calls, __ATOMIC_RELAXED);
+        for (int i = 0; i < LUA_JNI_STATS_BUCKETS; i++) {
+            row[i + 1] = (jlong) __atomic_load_n(&stats->histogram[i], __ATOMIC_RELAXED);
+        }
+        (*env)->SetLongArrayRegion(env, values, count * (LUA_JNI_STATS_BUCKETS + 1), LUA_JNI_STATS_BUCKETS + 1, row);
+        count++;
+    }
+    return count;
+}
+
+JNIEXPORT jint JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_bindingStatsCount(JNIEnv *env, jobject thiz) {
+    jint count = 0;
+    for (LuaJniBindingStats *stats = luaJniBindingStatsList(); stats; stats = stats->next) {
+        count++;
+    }
+    return count;
+}
+
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_setGcPolicy(JNIEnv *env, jobject thiz,
+                                                                       jlong native_ptr,
+                                                                       jlong handle_bytes,
+                                                                       jlong step_bytes,
+                                                                       jlong global_ref_limit,
+                                                                       jboolean generational) {
+    luaJniSetGcPolicy((lua_State *) native_ptr, handle_bytes, step_bytes, global_ref_limit, generational);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_setSizeEstimate(JNIEnv *env, jobject thiz,
+                                                                           jlong native_ptr,
+                                                                           jstring name,
+                                                                           jlong bytes) {
+    lua_State *L = (lua_State *) native_ptr;
+    const char *c_name = (*env)->GetStringUTFChars(env, name, 0);
+    jboolean r = luaJniSetSizeEstimate(L, c_name, bytes);
+    (*env)->ReleaseStringUTFChars(env, name, c_name);
+    return r;
+}
+
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_setLogLevel(JNIEnv *env, jobject thiz,
+                                                                       jint level) {
+    luaJniSetLogLevel(level);
+}
+
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_setLazyExceptions(JNIEnv *env, jobject thiz,
+                                                                             jlong native_ptr,
+                                                                             jboolean lazy) {
+    luaJniSetLazyExceptions((lua_State *) native_ptr, lazy);
+}
+
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_setCallBudget(JNIEnv *env, jobject thiz,
+                                                                         jlong native_ptr,
+                                                                         jlong max_instructions,
+                                                                         jlong timeout_millis) {
+    luaJniSetCallBudget((lua_State *) native_ptr, max_instructions, timeout_millis);
+}
+
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaInterpreter_00024Companion_cancel(JNIEnv *env, jobject thiz,
+                                                                  jlong native_ptr) {
+    luaJniCancel((lua_State *) native_ptr);
+}
+
+JNIEXPORT void JNICALL
+Java_top_lizhistudio_luajni_core_LuaCallback_00024Companion_release(JNIEnv *env, jobject thiz,
+                                                                jlong native_ptr) {
+    luaJniReleaseCallback((LuaJniCallback *) native_ptr);
+}
+
 JNIEXPORT jint JNI_OnLoad(JavaVM * vm, void * reserved)
 {
     JNIEnv * env = NULL;
@@ -5,15 +5,33 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 
 #include <lauxlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "mlog.h"
 
 #define JAVA_ARRAY_META_NAME "JavaArray"
+#define JAVA_THROWABLE_META_NAME "JavaThrowable"
+#define JAVA_ARRAY_ROWS_META_NAME "JavaArrayRows"
+#define JAVA_ITERATOR_META_NAME "LuaJniIterator"
+#define CALLBACK_CACHE_KEY "LuaJniCallbackCache"
+#define CALLBACK_ENTRY_META_NAME "LuaJniCallbackEntry"
+#define ITER_DEFAULT_CHUNK 256
+#define ITER_MAX_CHUNK 65536
 #define TABLE_SIZE 100
 #define PUSH_THROWABLE_ERROR "push java throwable error"
+#define LUA_ERROR_CLASS "top/lizhistudio/luajni/core/LuaError"
+#define LUA_ABORT_ERROR_CLASS "top/lizhistudio/luajni/core/LuaAbortError"
+
+int luaJniLogLevel = LUA_JNI_LOG_WARN;
+
+void luaJniSetLogLevel(int level) {
+    luaJniLogLevel = level;
+}
 
 
 typedef struct Value{
@@ -60,8 +78,94 @@ typedef struct Context{
     jmethodID longValue;
     jmethodID floatValue;
     jmethodID doubleValue;
+
+    jclass throwableClass;
+    jmethodID getMessage;
+    jmethodID getStackTrace;
+    jmethodID toString;
+
+    jclass stringClass;
+    jclass collectionClass;
+    jclass listClass;
+    jclass randomAccessClass;
+    jclass iterableClass;
+    jmethodID getName;
+    jmethodID size;
+    jmethodID toArray;
+    jmethodID subList;
+    jmethodID iterator;
+    jmethodID hasNext;
+    jmethodID next;
 }Context;
 
+typedef struct LuaJniProfiler LuaJniProfiler;
+
+#define STATS_MAX_FRAMES 32
+#define GC_SIZE_FIELD "__luajni_size"
+
+//handles pin java memory and global references lua can not see, they are charged to the collector as debt
+typedef struct GcPressure{
+    int64_t handleBytes;
+    int64_t stepBytes;
+    int64_t globalRefLimit;
+    //live handles which trigger the next full collection, raised while the script holds more than globalRefLimit
+    int64_t collectLimit;
+    int64_t handleMark;
+    int64_t debt;
+    int sizeEstimates;
+    //handles of this state only, the gauges of luaJniGetGauges are process wide
+    int64_t handlesCreated;
+    int64_t liveHandles;
+}GcPressure;
+
+typedef struct StatsFrame{
+    LuaJniBindingStats *stats;
+    int depth;
+    int64_t start;
+}StatsFrame;
+
+//limits of the outermost call, cancel is the only field written by other threads
+typedef struct LuaJniBudget{
+    int calls;
+    int active;
+    int tripped;
+    int cancel;
+    int64_t instructions;
+    int64_t remaining;
+    int64_t deadline;
+    int64_t callInstructions;
+    int64_t callTimeout;
+    //cancel flag and remaining instructions of the call which started this one on another state, see luaJniShareBudget
+    int *parent;
+    int64_t *pool;
+}LuaJniBudget;
+
+typedef struct LuaJniState{
+    JNIEnv *env;
+    LuaJniCallback *callbacks;
+    LuaJniCallback *releasedCallbacks;
+    int frameDepth;
+    LuaJniProfiler *profiler;
+    int statsCount;
+    StatsFrame statsFrames[STATS_MAX_FRAMES];
+    GcPressure gc;
+    int lazyExceptions;
+    LuaJniBudget budget;
+    int hookMask;
+    int hookCount;
+    //the thread which last set the env, proxies refuse calls from any other one
+    pthread_t owner;
+}LuaJniState;
+
+struct LuaJniCallback{
+    LuaJniState *state;
+    lua_State *L;
+    int ref;
+    int released;
+    LuaJniCallback *prev;
+    LuaJniCallback *next;
+};
+
 
 unsigned int hashMapHash(const char*key);
 void hashMapPut(HashMap*map, const char*key, LuaJniInjectMethod method, void*userData);
@@ -71,6 +175,7 @@ void hashMapClear(HashMap*map);
 HashMap *ensureHashMap();
 
 static Context * context = NULL;
+static pthread_mutex_t callbackLock = PTHREAD_MUTEX_INITIALIZER;
 
 
 
@@ -82,54 +187,237 @@ int luaJniEqualJavaArray(JavaArray* a, const char*className, int level, enum ARR
 }
 
 
+static int64_t globalRefs = 0;
+static int64_t handlesCreated = 0;
+static int64_t handlesCollected = 0;
+
 int64_t luaJniCacheObject(JNIEnv*env, jobject obj){
     jobject globalRef = (*env)->NewGlobalRef(env,obj);
+    __atomic_add_fetch(&globalRefs,1,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&handlesCreated,1,__ATOMIC_RELAXED);
     return (int64_t)globalRef;
 }
 
 void luaJniReleaseObject(JNIEnv*env, int64_t id){
     jobject obj = (jobject)id;
     (*env)->DeleteGlobalRef(env,obj);
+    __atomic_sub_fetch(&globalRefs,1,__ATOMIC_RELAXED);
+}
+
+static LuaJniState *getState(lua_State *L);
+
+static void gcTrackHandle(lua_State *L){
+    GcPressure *gc = &getState(L)->gc;
+    gc->handlesCreated++;
+    gc->liveHandles++;
+}
+
+//charge the size estimate of the class whose metatable is on the top of the stack
+static void gcChargeClass(lua_State *L){
+    LuaJniState *state = getState(L);
+    if(!state->gc.sizeEstimates) return;
+    if(lua_getfield(L,-1,GC_SIZE_FIELD) == LUA_TNUMBER){
+        state->gc.debt += lua_tointeger(L,-1);
+    }
+    lua_pop(L,1);
+}
+
+int luaJniPushObject(lua_State*L, JNIEnv*env, jobject obj, const char*className){
+    if(obj == NULL){
+        lua_pushnil(L);
+        return 1;
+    }
+    JavaObject *object = (JavaObject *) lua_newuserdata(L,sizeof(JavaObject));
+    object->id = 0;
+    if(!luaL_getmetatable(L,className)){
+        lua_pop(L,2);
+        lua_pushfstring(L,"can not find metatable for %s",className);
+        return 0;
+    }
+    object->id = luaJniCacheObject(env,obj);
+    gcTrackHandle(L);
+    gcChargeClass(L);
+    lua_setmetatable(L,-2);
+    return 1;
+}
+
+void luaJniNewObject(lua_State*L, JNIEnv*env, jobject obj, const char*className){
+    JavaObject *object = (JavaObject *) lua_newuserdata(L,sizeof(JavaObject));
+    object->id = 0;
+    //without a metatable there is no __gc to delete the reference
+    if(!luaL_getmetatable(L,className)){
+        lua_pop(L,1);
+        LOGD("can not find metatable for %s\n",className);
+        return;
+    }
+    object->id = luaJniCacheObject(env,obj);
+    gcTrackHandle(L);
+    gcChargeClass(L);
+    lua_setmetatable(L,-2);
+}
+
+void luaJniPushArray(lua_State*L, JNIEnv*env, jobject array, int level, const char*name,
+                     enum ARRAY_ELEMENT_TYPE elementType){
+    JavaArray *newArray = (JavaArray *) lua_newuserdata(L,sizeof(JavaArray));
+    newArray->id = luaJniCacheObject(env,array);
+    newArray->level = level;
+    newArray->name = name;
+    newArray->elementType = elementType;
+    gcTrackHandle(L);
+    luaL_setmetatable(L,JAVA_ARRAY_META_NAME);
 }
 
 
 int luaJniJavaObjectGc(lua_State *L){
     JavaObject *object = (JavaObject *) lua_touserdata(L,1);
     JNIEnv *env = luaJniGetEnv(L);
-    lua_getmetatable(L,1);
-    lua_getfield(L,-1,"__name");
-    const char *name = lua_tostring(L,-1);
-    LOGD("name %s env %p \n",name,env);
-    LOGD("delete global ref %p \n",luaJniTakeObject(env,object->id));
+    LOGT("delete global ref %p \n",luaJniTakeObject(env,object->id));
     (*env)->DeleteGlobalRef(env, luaJniTakeObject(env,object->id));
+    getState(L)->gc.liveHandles--;
+    __atomic_sub_fetch(&globalRefs,1,__ATOMIC_RELAXED);
+    __atomic_add_fetch(&handlesCollected,1,__ATOMIC_RELAXED);
     return 0;
 }
 
-static int pushJavaThrowable(JNIEnv* env,lua_State*L,jthrowable throwable)
+int luaJniPushCachedField(lua_State*L, int index, const char*name){
+    if(lua_getiuservalue(L,index,1) != LUA_TTABLE){
+        lua_pop(L,1);
+        return 0;
+    }
+    if(lua_getfield(L,-1,name) == LUA_TNIL){
+        lua_pop(L,2);
+        return 0;
+    }
+    lua_remove(L,-2);
+    return 1;
+}
+
+void luaJniCacheField(lua_State*L, int index, const char*name){
+    index = lua_absindex(L,index);
+    if(lua_getiuservalue(L,index,1) != LUA_TTABLE){
+        lua_pop(L,1);
+        lua_newtable(L);
+        lua_pushvalue(L,-1);
+        lua_setiuservalue(L,index,1);
+    }
+    lua_pushvalue(L,-2);
+    lua_setfield(L,-2,name);
+    lua_pop(L,1);
+}
+
+static int pushThrowableMessage(JNIEnv* env,lua_State*L,jthrowable throwable)
 {
-    jclass clazz = (*env)->FindClass(env,"java/lang/Throwable");
-    jmethodID method = (*env)->GetMethodID(env,clazz,"getMessage", "()Ljava/lang/String;");
-    jstring message = (jstring)(*env)->CallObjectMethod(env,throwable,method);
+    jstring message = (jstring)(*env)->CallObjectMethod(env,throwable,context->getMessage);
     if (!(*env)->ExceptionCheck(env))
     {
+        if(message == NULL){
+            lua_pushliteral(L,"null");
+            return 1;
+        }
         const char *cMessage = (*env)->GetStringUTFChars(env,message,0);
         lua_pushstring(L,cMessage);
         (*env)->ReleaseStringUTFChars(env,message,cMessage);
+        (*env)->DeleteLocalRef(env,message);
         return 1;
     }
-    (*env)->ExceptionDescribe(env);
+    if(LUA_JNI_LOG_ENABLED(LUA_JNI_LOG_WARN)){
+        (*env)->ExceptionDescribe(env);
+    }
     (*env)->ExceptionClear(env);
     return 0;
 }
 
+static void addJavaString(JNIEnv*env, luaL_Buffer*b, jstring str){
+    if(str == NULL){
+        luaL_addstring(b,"null");
+        return;
+    }
+    const char *cStr = (*env)->GetStringUTFChars(env,str,0);
+    luaL_addstring(b,cStr);
+    (*env)->ReleaseStringUTFChars(env,str,cStr);
+    (*env)->DeleteLocalRef(env,str);
+}
+
+//format like printStackTrace without the causes, return 0 and push nothing if java throws
+static int pushThrowableStackTrace(JNIEnv* env,lua_State*L,jthrowable throwable)
+{
+    jobjectArray elements = (jobjectArray)(*env)->CallObjectMethod(env,throwable,context->getStackTrace);
+    jstring str = (*env)->ExceptionCheck(env) ? NULL : (jstring)(*env)->CallObjectMethod(env,throwable,context->toString);
+    if((*env)->ExceptionCheck(env)){
+        (*env)->ExceptionClear(env);
+        if(elements) (*env)->DeleteLocalRef(env,elements);
+        return 0;
+    }
+    luaL_Buffer b;
+    luaL_buffinit(L,&b);
+    addJavaString(env,&b,str);
+    jsize length = elements ? (*env)->GetArrayLength(env,elements) : 0;
+    for(jsize i = 0; i < length; i++){
+        jobject element = (*env)->GetObjectArrayElement(env,elements,i);
+        str = (jstring)(*env)->CallObjectMethod(env,element,context->toString);
+        (*env)->DeleteLocalRef(env,element);
+        if((*env)->ExceptionCheck(env)){
+            (*env)->ExceptionClear(env);
+            break;
+        }
+        luaL_addstring(&b,"\n\tat ");
+        addJavaString(env,&b,str);
+    }
+    if(elements) (*env)->DeleteLocalRef(env,elements);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+//lazy mode keeps the throwable, message and stackTrace are only copied when a script reads them
+static int pushJavaThrowable(JNIEnv* env,lua_State*L,jthrowable throwable)
+{
+    if(getState(L)->lazyExceptions){
+        luaJniNewObject(L,env,throwable,JAVA_THROWABLE_META_NAME);
+        return 1;
+    }
+    return pushThrowableMessage(env,L,throwable);
+}
+
+static int javaThrowableField(lua_State*L, const char*name){
+    JavaObject *object = (JavaObject *) luaL_checkudata(L,1,JAVA_THROWABLE_META_NAME);
+    if(luaJniPushCachedField(L,1,name)){
+        return 1;
+    }
+    JNIEnv *env = luaJniGetEnv(L);
+    jthrowable throwable = (jthrowable)luaJniTakeObject(env,object->id);
+    int pushed = name[0] == 'm' ? pushThrowableMessage(env,L,throwable) : pushThrowableStackTrace(env,L,throwable);
+    luaJniPutBackObject(env,throwable);
+    if(!pushed){
+        return luaL_error(L,PUSH_THROWABLE_ERROR);
+    }
+    luaJniCacheField(L,1,name);
+    return 1;
+}
+
+static int javaThrowableToString(lua_State*L){
+    return javaThrowableField(L,"message");
+}
+
+static int javaThrowableIndex(lua_State*L){
+    const char *key = luaL_checkstring(L,2);
+    if(strcmp(key,"message") == 0 || strcmp(key,"stackTrace") == 0){
+        return javaThrowableField(L,key);
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
 int luaJniCatchJavaException(lua_State*L, JNIEnv*env){
     jthrowable throwable = (*env)->ExceptionOccurred(env);
     if(throwable){
-        (*env)->ExceptionDescribe(env);
+        if(LUA_JNI_LOG_ENABLED(LUA_JNI_LOG_DEBUG)){
+            (*env)->ExceptionDescribe(env);
+        }
         (*env)->ExceptionClear(env);
         if(!pushJavaThrowable(env,L,throwable)){
             lua_pushstring(L,PUSH_THROWABLE_ERROR);
         }
+        (*env)->DeleteLocalRef(env,throwable);
         return 1;
     }
     return 0;
@@ -142,297 +430,1682 @@ void luaJniCatchJavaAndThrowLuaException(lua_State*L, JNIEnv*env){
 }
 
 
-static int javaArrayIndex(lua_State*L){
-    JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
-    jint index = luaL_checkint(L,2);
-    JNIEnv *env = luaJniGetEnv(L);
-    jobject obj = luaJniTakeObject(env,array->id);
+//push the error message with the position of the script, for the helpers leaving lua_error to their caller
+static int pushArrayError(lua_State*L, const char*fmt, ...){
+    va_list args;
+    luaL_where(L,1);
+    va_start(args,fmt);
+    lua_pushvfstring(L,fmt,args);
+    va_end(args);
+    lua_concat(L,2);
+    return 0;
+}
+
+static int javaArrayCheckIndex(lua_State*L, JNIEnv*env, jobject obj, jint index){
     jint length = (*env)->GetArrayLength(env,obj);
     if(index <1 || index > length){
-        luaJniPutBackObject(env,obj);
-        luaL_error(L,"index out of range %d",index);
+        return pushArrayError(L,"index out of range %d",index);
     }
-    if(array->level >1){
-        jarray nArray = (*env)->GetObjectArrayElement(env,obj,index-1);
-        if(luaJniCatchJavaException(L, env)){
-            luaJniPutBackObject(env,obj);
-            lua_error(L);
+    return 1;
+}
+
+//the helpers below return 0 with the error message pushed and leave the references to their caller
+static int javaArrayPushElement(lua_State*L, JNIEnv*env, jobject obj, jint index, const char*name,
+                                enum ARRAY_ELEMENT_TYPE elementType){
+    switch (elementType){
+        case ELEMENT_BOOLEAN: {
+            jboolean value;
+            (*env)->GetBooleanArrayRegion(env,obj,index-1,1,&value);
+            lua_pushboolean(L, value);
+            break;
         }
-        if(nArray){
-            JavaArray *newArray = (JavaArray *) lua_newuserdata(L,sizeof(JavaArray));
-            newArray->id = luaJniCacheObject(env, nArray);
-            newArray->level = array->level -1;
-            newArray->name = array->name;
-            luaL_getmetatable(L,JAVA_ARRAY_META_NAME);
-            lua_setmetatable(L,-2);
-        }else{
-            lua_pushnil(L);
+        case ELEMENT_BYTE:{
+            jbyte value;
+            (*env)->GetByteArrayRegion(env,obj,index-1,1,&value);
+            lua_pushinteger(L,value);
+            break;
         }
-    }else{
-        switch (array->elementType){
-            case ELEMENT_BOOLEAN: {
-                jboolean value;
-                (*env)->GetBooleanArrayRegion(env,obj,index-1,1,&value);
-                lua_pushboolean(L, value);
-                break;
+        case ELEMENT_CHAR:{
+            jchar value;
+            (*env)->GetCharArrayRegion(env,obj,index-1,1,&value);
+            lua_pushinteger(L,value);
+            break;
+        }
+        case ELEMENT_SHORT: {
+            jshort value;
+            (*env)->GetShortArrayRegion(env,obj,index-1,1,&value);
+            lua_pushinteger(L,value);
+            break;
+        }
+        case ELEMENT_INT: {
+            jint value;
+            (*env)->GetIntArrayRegion(env, obj, index - 1, 1, &value);
+            lua_pushinteger(L, value);
+            break;
+        }
+        case ELEMENT_LONG:{
+            jlong value;
+            (*env)->GetLongArrayRegion(env,obj,index-1,1,&value);
+            lua_pushinteger(L,value);
+            break;
+        }
+        case ELEMENT_FLOAT:{
+            jfloat value;
+            (*env)->GetFloatArrayRegion(env,obj,index-1,1,&value);
+            lua_pushnumber(L,value);
+            break;
+        }
+        case ELEMENT_DOUBLE:{
+            jdouble value;
+            (*env)->GetDoubleArrayRegion(env,obj,index-1,1,&value);
+            lua_pushnumber(L,value);
+            break;
+        }
+        case ELEMENT_STRING:{
+            jstring value = (*env)->GetObjectArrayElement(env,obj,index-1);
+            if(value != NULL){
+                const char *str = (*env)->GetStringUTFChars(env,value,0);
+                lua_pushstring(L,str);
+                (*env)->ReleaseStringUTFChars(env,value,str);
+                (*env)->DeleteLocalRef(env,value);
+            }else{
+                lua_pushnil(L);
             }
-            case ELEMENT_BYTE:{
-                jbyte value;
-                (*env)->GetByteArrayRegion(env,obj,index-1,1,&value);
-                lua_pushinteger(L,value);
-                break;
+            break;
+        }
+        case ELEMENT_OBJECT: {
+            jobject value = (*env)->GetObjectArrayElement(env, obj, index - 1);
+            if (value != NULL) {
+                int r = luaJniPushObject(L,env,value,name);
+                (*env)->DeleteLocalRef(env,value);
+                if(!r){
+                    lua_pop(L,1);
+                    return pushArrayError(L,"can not find metatable for %s",name);
+                }
+            } else {
+                lua_pushnil(L);
             }
-            case ELEMENT_CHAR:{
-                jchar value;
-                (*env)->GetCharArrayRegion(env,obj,index-1,1,&value);
-                lua_pushinteger(L,value);
-                break;
+            break;
+        }
+    }
+    return 1;
+}
+
+static int javaArraySetElement(lua_State*L, JNIEnv*env, jobject obj, jint index, int level, const char*name,
+                               enum ARRAY_ELEMENT_TYPE elementType, int valueIndex){
+    if(level>1){
+        jobject value = NULL;
+        if(!lua_isnil(L,valueIndex)){
+            JavaArray *element = (JavaArray *) luaL_testudata(L,valueIndex,JAVA_ARRAY_META_NAME);
+            if(element == NULL){
+                return pushArrayError(L,"expect java array");
             }
-            case ELEMENT_SHORT: {
-                jshort value;
-                (*env)->GetShortArrayRegion(env,obj,index-1,1,&value);
-                lua_pushinteger(L,value);
-                break;
+            value = luaJniTakeObject(env,element->id);
+        }
+        (*env)->SetObjectArrayElement(env,obj,index-1,value);
+        if(value){
+            luaJniPutBackObject(env,value);
+        }
+        return !luaJniCatchJavaException(L, env);
+    }
+    int luaValueType = lua_type(L,valueIndex);
+    switch (elementType)  {
+        case ELEMENT_BOOLEAN:{
+            if(luaValueType != LUA_TBOOLEAN){
+                return pushArrayError(L,"expect boolean");
             }
-            case ELEMENT_INT: {
-                jint value;
-                (*env)->GetIntArrayRegion(env, obj, index - 1, 1, &value);
-                lua_pushinteger(L, value);
-                break;
+            jboolean value = lua_toboolean(L,valueIndex);
+            (*env)->SetBooleanArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_BYTE:{
+            if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,valueIndex)){
+                return pushArrayError(L,"expect number");
             }
-            case ELEMENT_LONG:{
-                jlong value;
-                (*env)->GetLongArrayRegion(env,obj,index-1,1,&value);
-                lua_pushinteger(L,value);
-                break;
+            jbyte value = lua_tointeger(L,valueIndex);
+            (*env)->SetByteArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_CHAR:{
+            if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,valueIndex)){
+                return pushArrayError(L,"expect number");
             }
-            case ELEMENT_FLOAT:{
-                jfloat value;
-                (*env)->GetFloatArrayRegion(env,obj,index-1,1,&value);
-                lua_pushnumber(L,value);
-                break;
+            jchar value = lua_tointeger(L,valueIndex);
+            (*env)->SetCharArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_SHORT:{
+            if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,valueIndex)){
+                return pushArrayError(L,"expect number");
             }
-            case ELEMENT_DOUBLE:{
-                jdouble value;
-                (*env)->GetDoubleArrayRegion(env,obj,index-1,1,&value);
-                lua_pushnumber(L,value);
-                break;
+            jshort value = lua_tointeger(L,valueIndex);
+            (*env)->SetShortArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_INT:{
+            if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,valueIndex)){
+                return pushArrayError(L,"expect number");
             }
-            case ELEMENT_STRING:{
-                jstring value = (*env)->GetObjectArrayElement(env,obj,index-1);
-                if(value != NULL){
-                    const char *str = (*env)->GetStringUTFChars(env,value,0);
-                    lua_pushstring(L,str);
-                    (*env)->ReleaseStringUTFChars(env,value,str);
-                    (*env)->DeleteLocalRef(env,value);
-                }else{
-                    lua_pushnil(L);
-                }
-                break;
+            jint value = lua_tointeger(L,valueIndex);
+            (*env)->SetIntArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_LONG:{
+            if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,valueIndex)){
+                return pushArrayError(L,"expect number");
+            }
+            jlong value = lua_tointeger(L,valueIndex);
+            (*env)->SetLongArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_FLOAT:{
+            if(luaValueType != LUA_TNUMBER){
+                return pushArrayError(L,"expect number");
+            }
+            jfloat value = lua_tonumber(L,valueIndex);
+            (*env)->SetFloatArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_DOUBLE:{
+            if(luaValueType != LUA_TNUMBER){
+                return pushArrayError(L,"expect number");
+            }
+            jdouble value = lua_tonumber(L,valueIndex);
+            (*env)->SetDoubleArrayRegion(env,obj,index-1,1,&value);
+            break;
+        }
+        case ELEMENT_STRING:{
+            if(luaValueType != LUA_TSTRING){
+                return pushArrayError(L,"expect string");
             }
-            case ELEMENT_OBJECT: {
-                jobject value = (*env)->GetObjectArrayElement(env, obj, index - 1);
-                if (value != NULL) {
-                    int64_t id = luaJniCacheObject(env, value);
-                    JavaObject *object = (JavaObject *) lua_newuserdata(L, sizeof(JavaObject));
-                    object->id = id;
-                    (*env)->DeleteLocalRef(env,value);
-                    int r = luaL_getmetatable(L, array->name);
-                    if (r) {
-                        lua_setmetatable(L, -2);
-                    } else {
-                        luaJniReleaseObject(env, id);
-                        luaJniPutBackObject(env,obj);
-                        luaL_error(L, "can not find metatable for %s", array->name);
-                    }
-                } else {
-                    lua_pushnil(L);
+            const char *str = lua_tostring(L,valueIndex);
+            jstring value = (*env)->NewStringUTF(env,str);
+            (*env)->SetObjectArrayElement(env,obj,index-1,value);
+            (*env)->DeleteLocalRef(env,value);
+            break;
+        }
+        case ELEMENT_OBJECT:{
+            jobject value = NULL;
+            if(luaValueType == LUA_TUSERDATA){
+                JavaObject *element = (JavaObject *) luaL_testudata(L,valueIndex,name);
+                if(element == NULL){
+                    return pushArrayError(L,"expect java object %s",name);
                 }
-                break;
+                value = luaJniTakeObject(env,element->id);
+            }else if(luaValueType != LUA_TNIL) {
+                return pushArrayError(L,"expect java object %s",name);
+            }
+            (*env)->SetObjectArrayElement(env,obj,index-1,value);
+            if(value){
+                luaJniPutBackObject(env,value);
             }
+            return !luaJniCatchJavaException(L, env);
+        }
+    }
+    return 1;
+}
+
+//the row views of arr[i] are kept in a weak table of the parent, reused while the java row is the same object
+static int javaArrayPushRow(lua_State*L, JNIEnv*env, JavaArray*array, jobject obj, jint index){
+    jobject row = (*env)->GetObjectArrayElement(env,obj,index-1);
+    if(luaJniCatchJavaException(L, env)){
+        return 0;
+    }
+    if(row == NULL){
+        lua_pushnil(L);
+        return 1;
+    }
+    if(lua_getiuservalue(L,1,1) != LUA_TTABLE){
+        lua_pop(L,1);
+        lua_newtable(L);
+        luaL_setmetatable(L,JAVA_ARRAY_ROWS_META_NAME);
+        lua_pushvalue(L,-1);
+        lua_setiuservalue(L,1,1);
+    }
+    if(lua_rawgeti(L,-1,index) == LUA_TUSERDATA){
+        JavaArray *cached = (JavaArray *) lua_touserdata(L,-1);
+        jobject cachedRow = luaJniTakeObject(env,cached->id);
+        int same = (*env)->IsSameObject(env,cachedRow,row);
+        luaJniPutBackObject(env,cachedRow);
+        if(same){
+            (*env)->DeleteLocalRef(env,row);
+            lua_remove(L,-2);
+            return 1;
+        }
+    }
+    lua_pop(L,1);
+    luaJniPushArray(L,env,row,array->level-1,array->name,array->elementType);
+    (*env)->DeleteLocalRef(env,row);
+    lua_pushvalue(L,-1);
+    lua_rawseti(L,-3,index);
+    lua_remove(L,-2);
+    return 1;
+}
+
+static int javaArrayGet(lua_State*L);
+static int javaArraySet(lua_State*L);
+
+static int javaArrayIndex(lua_State*L){
+    JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
+    if(lua_type(L,2) == LUA_TSTRING){
+        const char *key = lua_tostring(L,2);
+        if(strcmp(key,"get") == 0){
+            lua_pushcfunction(L,javaArrayGet);
+        }else if(strcmp(key,"set") == 0){
+            lua_pushcfunction(L,javaArraySet);
+        }else{
+            lua_pushnil(L);
         }
+        return 1;
+    }
+    jint index = luaL_checkint(L,2);
+    JNIEnv *env = luaJniGetEnv(L);
+    jobject obj = luaJniTakeObject(env,array->id);
+    int r = javaArrayCheckIndex(L,env,obj,index);
+    if(r){
+        r = array->level > 1 ? javaArrayPushRow(L,env,array,obj,index)
+                             : javaArrayPushElement(L,env,obj,index,array->name,array->elementType);
     }
     luaJniPutBackObject(env,obj);
+    if(!r){
+        lua_error(L);
+    }
     return 1;
 }
+
 static int javaArrayNewIndex(lua_State*L){
     JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
     jint index = luaL_checkint(L,2);
     JNIEnv *env = luaJniGetEnv(L);
     jobject obj = luaJniTakeObject(env,array->id);
+    int r = javaArrayCheckIndex(L,env,obj,index) &&
+            javaArraySetElement(L,env,obj,index,array->level,array->name,array->elementType,3);
+    luaJniPutBackObject(env,obj);
+    if(!r){
+        lua_error(L);
+    }
+    return 0;
+}
+
+//follow count indexes from the stack index start, the row is a new local reference unless count is 0,
+//NULL is a null row or an error, error is set and the message pushed for the latter
+static jobject javaArrayWalk(lua_State*L, JNIEnv*env, jobject obj, int start, int count, int *error){
+    jobject row = obj;
+    *error = 0;
+    for(int i = 0; i < count; i++){
+        jint index = (jint) lua_tointeger(L,start + i);
+        jobject next = NULL;
+        if(!javaArrayCheckIndex(L,env,row,index)){
+            *error = 1;
+        }else{
+            next = (*env)->GetObjectArrayElement(env,row,index-1);
+            *error = luaJniCatchJavaException(L, env);
+        }
+        if(row != obj){
+            (*env)->DeleteLocalRef(env,row);
+        }
+        if(*error || next == NULL){
+            return NULL;
+        }
+        row = next;
+    }
+    return row;
+}
+
+static int javaArrayCheckIndexes(lua_State*L, JavaArray*array, int count){
+    luaL_argcheck(L,count >= 1 && count <= array->level,2,"expect 1 to level indexes");
+    for(int i = 0; i < count; i++){
+        luaL_checkinteger(L,2 + i);
+    }
+    return count;
+}
+
+//arr:get(i, j, ...) reads through the levels with local references, a handle is only made for a returned row
+static int javaArrayGet(lua_State*L){
+    JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
+    int count = javaArrayCheckIndexes(L,array,lua_gettop(L) - 1);
+    JNIEnv *env = luaJniGetEnv(L);
+    jobject obj = luaJniTakeObject(env,array->id);
+    int error;
+    jobject row = javaArrayWalk(L,env,obj,2,count - 1,&error);
+    int r = !error;
+    if(row == NULL){
+        if(r) lua_pushnil(L);
+    }else{
+        jint index = (jint) lua_tointeger(L,count + 1);
+        int level = array->level - count + 1;
+        r = javaArrayCheckIndex(L,env,row,index);
+        if(r && level > 1){
+            jobject value = (*env)->GetObjectArrayElement(env,row,index-1);
+            r = !luaJniCatchJavaException(L, env);
+            if(r && value){
+                luaJniPushArray(L,env,value,level - 1,array->name,array->elementType);
+                (*env)->DeleteLocalRef(env,value);
+            }else if(r){
+                lua_pushnil(L);
+            }
+        }else if(r){
+            r = javaArrayPushElement(L,env,row,index,array->name,array->elementType);
+        }
+        if(row != obj){
+            (*env)->DeleteLocalRef(env,row);
+        }
+    }
+    luaJniPutBackObject(env,obj);
+    if(!r){
+        lua_error(L);
+    }
+    return 1;
+}
+
+//arr:set(i, j, ..., value)
+static int javaArraySet(lua_State*L){
+    JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
+    int count = javaArrayCheckIndexes(L,array,lua_gettop(L) - 2);
+    JNIEnv *env = luaJniGetEnv(L);
+    jobject obj = luaJniTakeObject(env,array->id);
+    int error;
+    jobject row = javaArrayWalk(L,env,obj,2,count - 1,&error);
+    int r = !error;
+    if(row == NULL){
+        if(r) r = pushArrayError(L,"attempt to index a null array");
+    }else{
+        jint index = (jint) lua_tointeger(L,count + 1);
+        r = javaArrayCheckIndex(L,env,row,index) &&
+            javaArraySetElement(L,env,row,index,array->level - count + 1,array->name,array->elementType,count + 2);
+        if(row != obj){
+            (*env)->DeleteLocalRef(env,row);
+        }
+    }
+    luaJniPutBackObject(env,obj);
+    if(!r){
+        lua_error(L);
+    }
+    return 0;
+}
+
+static int javaArrayLen(lua_State*L){
+    JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
+    JNIEnv *env = luaJniGetEnv(L);
+    jobject obj = luaJniTakeObject(env,array->id);
     jint length = (*env)->GetArrayLength(env,obj);
-    if(index <1 || index > length){
+    if(luaJniCatchJavaException(L, env)){
         luaJniPutBackObject(env,obj);
-        luaL_error(L,"index out of range %d",index);
+        lua_error(L);
     }
-    if(array->level>1){
-        jobject value = NULL;
-        if(!lua_isnil(L,3)){
-            JavaArray *element = (JavaArray *) luaL_testudata(L,3,JAVA_ARRAY_META_NAME);
-            if(element == NULL){
-                luaJniPutBackObject(env,obj);
-                luaL_error(L,"expect java array");
+    lua_pushinteger(L,length);
+    luaJniPutBackObject(env,obj);
+    return 1;
+}
+
+enum ITER_KIND{
+    ITER_ARRAY,
+    ITER_LIST,
+    ITER_ITERATOR
+};
+
+//source is a global ref of the array, the random access list or the java iterator, primitive elements are
+//copied into data and list elements into the chunk array, chunkSize at a time
+typedef struct JavaIterator{
+    enum ITER_KIND kind;
+    jobject source;
+    jobjectArray chunk;
+    jclass lastClass;
+    enum LUA_JNI_VALUE_TYPE lastType;
+    const char *name;
+    int resolve;
+    int primitive;
+    int level;
+    enum ARRAY_ELEMENT_TYPE elementType;
+    jint length;
+    jint chunkSize;
+    jint base;
+    jint buffered;
+    jint cursor;
+    lua_Integer index;
+    jlong data[];
+}JavaIterator;
+
+static void javaIteratorClose(JNIEnv*env, JavaIterator*it){
+    if(it->source){
+        luaJniReleaseObject(env,(int64_t)it->source);
+        it->source = NULL;
+    }
+    if(it->chunk){
+        (*env)->DeleteGlobalRef(env,it->chunk);
+        it->chunk = NULL;
+    }
+    if(it->lastClass){
+        (*env)->DeleteGlobalRef(env,it->lastClass);
+        it->lastClass = NULL;
+    }
+}
+
+static int javaIteratorGc(lua_State*L){
+    javaIteratorClose(luaJniGetEnv(L),(JavaIterator *) lua_touserdata(L,1));
+    return 0;
+}
+
+//string and the boxed types are final, so the exact class decides
+static enum LUA_JNI_VALUE_TYPE javaIteratorClassify(JNIEnv*env, jclass clazz){
+    if((*env)->IsSameObject(env,clazz,context->stringClass)) return VALUE_STRING;
+    if((*env)->IsSameObject(env,clazz,context->intClass)) return VALUE_WRAPPER_INT;
+    if((*env)->IsSameObject(env,clazz,context->longClass)) return VALUE_WRAPPER_LONG;
+    if((*env)->IsSameObject(env,clazz,context->doubleClass)) return VALUE_WRAPPER_DOUBLE;
+    if((*env)->IsSameObject(env,clazz,context->booleanClass)) return VALUE_WRAPPER_BOOLEAN;
+    if((*env)->IsSameObject(env,clazz,context->floatClass)) return VALUE_WRAPPER_FLOAT;
+    if((*env)->IsSameObject(env,clazz,context->shortClass)) return VALUE_WRAPPER_SHORT;
+    if((*env)->IsSameObject(env,clazz,context->byteClass)) return VALUE_WRAPPER_BYTE;
+    if((*env)->IsSameObject(env,clazz,context->charClass)) return VALUE_WRAPPER_CHAR;
+    return VALUE_OBJECT;
+}
+
+//strings and boxed values become lua values, other objects are pushed with the metatable of their class,
+//the class is classified once per run of elements of the same class and its name kept in the user value
+static int javaIteratorPushValue(lua_State*L, JNIEnv*env, JavaIterator*it, jobject value){
+    if(value == NULL){
+        lua_pushnil(L);
+        return 1;
+    }
+    if(!it->resolve){
+        return luaJniPushObject(L,env,value,it->name);
+    }
+    jclass clazz = (*env)->GetObjectClass(env,value);
+    if(it->lastClass == NULL || !(*env)->IsSameObject(env,clazz,it->lastClass)){
+        enum LUA_JNI_VALUE_TYPE type = javaIteratorClassify(env,clazz);
+        if(type == VALUE_OBJECT){
+            jstring name = (jstring)(*env)->CallObjectMethod(env,clazz,context->getName);
+            if(luaJniCatchJavaException(L,env)){
+                (*env)->DeleteLocalRef(env,clazz);
+                return 0;
             }
-            value = luaJniTakeObject(env,element->id);
+            const char *cName = (*env)->GetStringUTFChars(env,name,0);
+            lua_pushstring(L,cName);
+            (*env)->ReleaseStringUTFChars(env,name,cName);
+            (*env)->DeleteLocalRef(env,name);
+            it->name = lua_tostring(L,-1);
+            lua_setiuservalue(L,1,1);
         }
-        (*env)->SetObjectArrayElement(env,obj,index-1,value);
-        if(luaJniCatchJavaException(L, env)){
-            luaJniPutBackObject(env,obj);
-            if(value){
-                luaJniPutBackObject(env,value);
-            }
-            lua_error(L);
+        if(it->lastClass){
+            (*env)->DeleteGlobalRef(env,it->lastClass);
         }
-        if(value){
-            luaJniPutBackObject(env,value);
+        it->lastClass = (jclass)(*env)->NewGlobalRef(env,clazz);
+        it->lastType = type;
+    }
+    (*env)->DeleteLocalRef(env,clazz);
+    switch (it->lastType) {
+        case VALUE_STRING: {
+            const char *str = (*env)->GetStringUTFChars(env,(jstring)value,0);
+            lua_pushstring(L,str);
+            (*env)->ReleaseStringUTFChars(env,(jstring)value,str);
+            return 1;
         }
+        case VALUE_WRAPPER_INT: lua_pushinteger(L,luaJniIntValue(env,value)); return 1;
+        case VALUE_WRAPPER_LONG: lua_pushinteger(L,luaJniLongValue(env,value)); return 1;
+        case VALUE_WRAPPER_DOUBLE: lua_pushnumber(L,luaJniDoubleValue(env,value)); return 1;
+        case VALUE_WRAPPER_BOOLEAN: lua_pushboolean(L,luaJniBooleanValue(env,value)); return 1;
+        case VALUE_WRAPPER_FLOAT: lua_pushnumber(L,luaJniFloatValue(env,value)); return 1;
+        case VALUE_WRAPPER_SHORT: lua_pushinteger(L,luaJniShortValue(env,value)); return 1;
+        case VALUE_WRAPPER_BYTE: lua_pushinteger(L,luaJniByteValue(env,value)); return 1;
+        case VALUE_WRAPPER_CHAR: lua_pushinteger(L,luaJniCharValue(env,value)); return 1;
+        default: return luaJniPushObject(L,env,value,it->name);
     }
-    else{
-        int luaValueType = lua_type(L,3);
-        switch (array->elementType)  {
-            case ELEMENT_BOOLEAN:{
-                if(luaValueType != LUA_TBOOLEAN){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect boolean");
-                }
-                jboolean value = lua_toboolean(L,3);
-                (*env)->SetBooleanArrayRegion(env,obj,index-1,1,&value);
+}
+
+//copy the next chunk, return 0 at the end, java exceptions are raised
+static int javaIteratorFill(lua_State*L, JNIEnv*env, JavaIterator*it){
+    it->base += it->buffered;
+    it->buffered = 0;
+    it->cursor = 0;
+    if(it->base >= it->length){
+        return 0;
+    }
+    jint count = it->length - it->base < it->chunkSize ? it->length - it->base : it->chunkSize;
+    if(it->kind == ITER_LIST){
+        jobject slice = (*env)->CallObjectMethod(env,it->source,context->subList,it->base,it->base + count);
+        luaJniCatchJavaAndThrowLuaException(L,env);
+        jobject values = (*env)->CallObjectMethod(env,slice,context->toArray);
+        (*env)->DeleteLocalRef(env,slice);
+        luaJniCatchJavaAndThrowLuaException(L,env);
+        if(it->chunk){
+            (*env)->DeleteGlobalRef(env,it->chunk);
+        }
+        it->chunk = (jobjectArray)(*env)->NewGlobalRef(env,values);
+        (*env)->DeleteLocalRef(env,values);
+    }else if(it->primitive){
+        void *data = it->data;
+        switch(it->elementType){
+            case ELEMENT_BOOLEAN:
+                (*env)->GetBooleanArrayRegion(env,it->source,it->base,count,(jboolean *)data);
                 break;
-            }
-            case ELEMENT_BYTE:{
-                if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,3)){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jbyte value = lua_tointeger(L,3);
-                (*env)->SetByteArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_BYTE:
+                (*env)->GetByteArrayRegion(env,it->source,it->base,count,(jbyte *)data);
                 break;
-            }
-            case ELEMENT_CHAR:{
-                if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,3)){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jchar value = lua_tointeger(L,3);
-                (*env)->SetCharArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_CHAR:
+                (*env)->GetCharArrayRegion(env,it->source,it->base,count,(jchar *)data);
                 break;
-            }
-            case ELEMENT_SHORT:{
-                if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,3)){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jshort value = lua_tointeger(L,3);
-                (*env)->SetShortArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_SHORT:
+                (*env)->GetShortArrayRegion(env,it->source,it->base,count,(jshort *)data);
                 break;
-            }
-            case ELEMENT_INT:{
-                if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,3)){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jint value = lua_tointeger(L,3);
-                (*env)->SetIntArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_INT:
+                (*env)->GetIntArrayRegion(env,it->source,it->base,count,(jint *)data);
                 break;
-            }
-            case ELEMENT_LONG:{
-                if(luaValueType != LUA_TNUMBER || !lua_isinteger(L,3)){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jlong value = lua_tointeger(L,3);
-                (*env)->SetLongArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_LONG:
+                (*env)->GetLongArrayRegion(env,it->source,it->base,count,(jlong *)data);
                 break;
-            }
-            case ELEMENT_FLOAT:{
-                if(luaValueType != LUA_TNUMBER){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jfloat value = lua_tonumber(L,3);
-                (*env)->SetFloatArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_FLOAT:
+                (*env)->GetFloatArrayRegion(env,it->source,it->base,count,(jfloat *)data);
                 break;
-            }
-            case ELEMENT_DOUBLE:{
-                if(luaValueType != LUA_TNUMBER){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect number");
-                }
-                jdouble value = lua_tonumber(L,3);
-                (*env)->SetDoubleArrayRegion(env,obj,index-1,1,&value);
+            case ELEMENT_DOUBLE:
+                (*env)->GetDoubleArrayRegion(env,it->source,it->base,count,(jdouble *)data);
                 break;
-            }
-            case ELEMENT_STRING:{
-                if(luaValueType != LUA_TSTRING){
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect string");
-                }
-                const char *str = lua_tostring(L,3);
-                jstring value = (*env)->NewStringUTF(env,str);
-                (*env)->SetObjectArrayElement(env,obj,index-1,value);
-                (*env)->DeleteLocalRef(env,value);
+            default:
                 break;
+        }
+        luaJniCatchJavaAndThrowLuaException(L,env);
+    }
+    it->buffered = count;
+    return 1;
+}
+
+static int javaIteratorPushBuffered(lua_State*L, JNIEnv*env, JavaIterator*it){
+    jint i = it->cursor;
+    if(it->kind == ITER_LIST){
+        jobject value = (*env)->GetObjectArrayElement(env,it->chunk,i);
+        int r = javaIteratorPushValue(L,env,it,value);
+        if(value) (*env)->DeleteLocalRef(env,value);
+        return r;
+    }
+    if(it->primitive){
+        void *data = it->data;
+        switch(it->elementType){
+            case ELEMENT_BOOLEAN: lua_pushboolean(L,((jboolean *)data)[i]); break;
+            case ELEMENT_BYTE: lua_pushinteger(L,((jbyte *)data)[i]); break;
+            case ELEMENT_CHAR: lua_pushinteger(L,((jchar *)data)[i]); break;
+            case ELEMENT_SHORT: lua_pushinteger(L,((jshort *)data)[i]); break;
+            case ELEMENT_INT: lua_pushinteger(L,((jint *)data)[i]); break;
+            case ELEMENT_LONG: lua_pushinteger(L,((jlong *)data)[i]); break;
+            case ELEMENT_FLOAT: lua_pushnumber(L,((jfloat *)data)[i]); break;
+            case ELEMENT_DOUBLE: lua_pushnumber(L,((jdouble *)data)[i]); break;
+            default: lua_pushnil(L); break;
+        }
+        return 1;
+    }
+    jint index = it->base + i;
+    if(it->level > 1 || it->resolve){
+        jobject value = (*env)->GetObjectArrayElement(env,it->source,index);
+        if(luaJniCatchJavaException(L,env)){
+            return 0;
+        }
+        int r = 1;
+        if(it->level > 1 && value){
+            luaJniPushArray(L,env,value,it->level - 1,it->name,it->elementType);
+        }else{
+            r = javaIteratorPushValue(L,env,it,value);
+        }
+        if(value) (*env)->DeleteLocalRef(env,value);
+        return r;
+    }
+    return javaArrayPushElement(L,env,it->source,index + 1,it->name,it->elementType);
+}
+
+//next(iterator, index), the references are released as soon as the end is reached
+static int javaIteratorNext(lua_State*L){
+    JavaIterator *it = (JavaIterator *) luaL_checkudata(L,1,JAVA_ITERATOR_META_NAME);
+    JNIEnv *env = luaJniGetEnv(L);
+    if(it->source == NULL){
+        lua_pushnil(L);
+        return 1;
+    }
+    int r;
+    if(it->kind == ITER_ITERATOR){
+        jboolean hasNext = (*env)->CallBooleanMethod(env,it->source,context->hasNext);
+        luaJniCatchJavaAndThrowLuaException(L,env);
+        if(!hasNext){
+            javaIteratorClose(env,it);
+            lua_pushnil(L);
+            return 1;
+        }
+        jobject value = (*env)->CallObjectMethod(env,it->source,context->next);
+        luaJniCatchJavaAndThrowLuaException(L,env);
+        lua_pushinteger(L,++it->index);
+        r = javaIteratorPushValue(L,env,it,value);
+        if(value) (*env)->DeleteLocalRef(env,value);
+    }else{
+        if(it->cursor >= it->buffered && !javaIteratorFill(L,env,it)){
+            javaIteratorClose(env,it);
+            lua_pushnil(L);
+            return 1;
+        }
+        lua_pushinteger(L,++it->index);
+        r = javaIteratorPushBuffered(L,env,it);
+        it->cursor++;
+    }
+    if(!r){
+        lua_error(L);
+    }
+    return 2;
+}
+
+static JavaIterator *newJavaIterator(lua_State*L, jint chunkSize, int primitive){
+    size_t size = sizeof(JavaIterator) + (primitive ? sizeof(jlong) * chunkSize : 0);
+    JavaIterator *it = (JavaIterator *) lua_newuserdatauv(L,size,1);
+    memset(it,0,size);
+    it->chunkSize = chunkSize;
+    it->primitive = primitive;
+    luaL_setmetatable(L,JAVA_ITERATOR_META_NAME);
+    return it;
+}
+
+//throw the exception of the last call on obj before anything else reaches jni
+static void javaIteratorCheck(lua_State*L, JNIEnv*env, jobject obj){
+    if((*env)->ExceptionCheck(env)){
+        luaJniPutBackObject(env,obj);
+        luaJniCatchJavaAndThrowLuaException(L,env);
+    }
+}
+
+//push next, iterator, 0 for the generic for over the java array or object at index 1
+static int pushJavaIterator(lua_State*L, jint chunkSize, int classNameIndex){
+    JNIEnv *env = luaJniGetEnv(L);
+    JavaIterator *it;
+    JavaArray *array = (JavaArray *) luaL_testudata(L,1,JAVA_ARRAY_META_NAME);
+    if(array){
+        int primitive = array->level == 1 && array->elementType < ELEMENT_STRING;
+        it = newJavaIterator(L,chunkSize,primitive);
+        jobject obj = luaJniTakeObject(env,array->id);
+        it->kind = ITER_ARRAY;
+        it->length = (*env)->GetArrayLength(env,obj);
+        it->source = (jobject)luaJniCacheObject(env,obj);
+        luaJniPutBackObject(env,obj);
+        it->level = array->level;
+        it->name = array->name;
+        it->elementType = array->elementType;
+    }else{
+        jobject obj = NULL;
+        if(lua_type(L,1) == LUA_TUSERDATA && lua_getmetatable(L,1)){
+            lua_getfield(L,-1,"__gc");
+            if(lua_tocfunction(L,-1) == luaJniJavaObjectGc){
+                obj = luaJniTakeObject(env,((JavaObject *) lua_touserdata(L,1))->id);
             }
-            case ELEMENT_OBJECT:{
-                jobject value = NULL;
-                if(luaValueType == LUA_TUSERDATA){
-                    JavaObject *element = (JavaObject *) luaL_testudata(L,3,array->name);
-                    if(element == NULL){
-                        luaJniPutBackObject(env,obj);
-                        luaL_error(L,"expect java object %s",array->name);
-                    }
-                    value = luaJniTakeObject(env,element->id);
-                }else if(luaValueType == LUA_TNIL) {
-                    value = NULL;
-                }else {
-                    luaJniPutBackObject(env,obj);
-                    luaL_error(L,"expect java object %s",array->name);
-                }
-                (*env)->SetObjectArrayElement(env,obj,index-1,value);
-                if(luaJniCatchJavaException(L, env)){
-                    luaJniPutBackObject(env,obj);
-                    if(value){
-                        luaJniPutBackObject(env,value);
-                    }
-                    lua_error(L);
-                }
-                if(value){
-                    luaJniPutBackObject(env,value);
-                }
-                break;
+            lua_pop(L,2);
+        }
+        if(obj == NULL){
+            return luaL_argerror(L,1,"expect java array, Iterable or Collection");
+        }
+        it = newJavaIterator(L,chunkSize,0);
+        it->level = 1;
+        it->elementType = ELEMENT_OBJECT;
+        it->resolve = 1;
+        jobject source;
+        if((*env)->IsInstanceOf(env,obj,context->listClass) && (*env)->IsInstanceOf(env,obj,context->randomAccessClass)){
+            it->kind = ITER_LIST;
+            it->length = (*env)->CallIntMethod(env,obj,context->size);
+            javaIteratorCheck(L,env,obj);
+            source = (*env)->NewLocalRef(env,obj);
+        }else if((*env)->IsInstanceOf(env,obj,context->collectionClass)){
+            it->kind = ITER_ARRAY;
+            source = (*env)->CallObjectMethod(env,obj,context->toArray);
+            javaIteratorCheck(L,env,obj);
+            if(source) it->length = (*env)->GetArrayLength(env,source);
+        }else if((*env)->IsInstanceOf(env,obj,context->iterableClass)){
+            it->kind = ITER_ITERATOR;
+            source = (*env)->CallObjectMethod(env,obj,context->iterator);
+            javaIteratorCheck(L,env,obj);
+        }else{
+            luaJniPutBackObject(env,obj);
+            return luaL_argerror(L,1,"expect java array, Iterable or Collection");
+        }
+        luaJniPutBackObject(env,obj);
+        if(source){
+            it->source = (jobject)luaJniCacheObject(env,source);
+            (*env)->DeleteLocalRef(env,source);
+        }
+    }
+    if(classNameIndex && !lua_isnoneornil(L,classNameIndex)){
+        it->name = luaL_checkstring(L,classNameIndex);
+        it->resolve = 0;
+        lua_pushvalue(L,classNameIndex);
+        lua_setiuservalue(L,-2,1);
+    }
+    lua_pushcfunction(L,javaIteratorNext);
+    lua_insert(L,-2);
+    lua_pushinteger(L,0);
+    return 3;
+}
+
+//luajni.iter(obj [, chunk [, className]]), for i, v in luajni.iter(list) do ... end
+static int javaIter(lua_State*L){
+    lua_Integer chunkSize = luaL_optinteger(L,2,ITER_DEFAULT_CHUNK);
+    luaL_argcheck(L,chunkSize > 0 && chunkSize <= ITER_MAX_CHUNK,2,"chunk out of range");
+    return pushJavaIterator(L,(jint) chunkSize,3);
+}
+
+//lua 5.4 ignores __ipairs, ipairs(array) keeps indexing one element at a time, pairs and luajni.iter copy chunks
+static int javaArrayPairs(lua_State*L){
+    luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
+    lua_settop(L,1);
+    return pushJavaIterator(L,ITER_DEFAULT_CHUNK,0);
+}
+
+static LuaJniState *getState(lua_State *L){
+    return *(LuaJniState **) lua_getextraspace(L);
+}
+
+#define PROFILER_MAX_BINDINGS 32
+#define PROFILER_MAX_LEVELS 64
+#define PROFILER_NAME_SIZE 64
+
+typedef struct ProfilerBinding{
+    const char *className;
+    char member[PROFILER_NAME_SIZE];
+    int depth;
+    int64_t start;
+    int64_t children;
+}ProfilerBinding;
+
+//time is attributed in nanoseconds, lua code by the count hook and bindings by sampling one call of every bindingInterval
+struct LuaJniProfiler{
+    int interval;
+    int pending;
+    int bindingInterval;
+    int calls;
+    int64_t last;
+    int64_t bindingTime;
+    int samples;
+    int count;
+    ProfilerBinding bindings[PROFILER_MAX_BINDINGS];
+};
+
+static int64_t profilerNow(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//time spent outside the interpreter is not attributed
+static void profilerReset(LuaJniState *state){
+    if(state->profiler){
+        state->profiler->last = profilerNow();
+        state->profiler->bindingTime = 0;
+    }
+}
+
+static void profilerAddName(luaL_Buffer *b, const char *name){
+    for(; *name; name++){
+        luaL_addchar(b,(*name == ';' || *name == '\n') ? ',' : *name);
+    }
+}
+
+static void profilerAddFrame(luaL_Buffer *b, lua_Debug *ar){
+    if(strcmp(ar->what,"main") == 0){
+        luaL_addstring(b,"main@");
+        profilerAddName(b,ar->short_src);
+        return;
+    }
+    profilerAddName(b,ar->name ? ar->name : "?");
+    if(ar->what[0] != 'C'){
+        char line[16];
+        luaL_addchar(b,'@');
+        profilerAddName(b,ar->short_src);
+        snprintf(line,sizeof(line),":%d",ar->linedefined);
+        luaL_addstring(b,line);
+    }
+}
+
+//push the collapsed stack, outermost frame first, the C function of a binding is replaced by its java member
+static void profilerPushStack(lua_State *L, const ProfilerBinding *binding){
+    lua_Debug ar;
+    int skip = 0;
+    if(binding && lua_getstack(L,0,&ar) && lua_getinfo(L,"S",&ar) && ar.what[0] == 'C'){
+        skip = 1;
+    }
+    int levels = skip;
+    while(levels < PROFILER_MAX_LEVELS && lua_getstack(L,levels,&ar)){
+        levels++;
+    }
+    luaL_Buffer b;
+    luaL_buffinit(L,&b);
+    for(int level = levels - 1; level >= skip; level--){
+        lua_getstack(L,level,&ar);
+        lua_getinfo(L,"Sn",&ar);
+        profilerAddFrame(&b,&ar);
+        if(level > skip || binding){
+            luaL_addchar(&b,';');
+        }
+    }
+    if(binding){
+        luaL_addstring(&b,"java:");
+        profilerAddName(&b,binding->className);
+        luaL_addchar(&b,'.');
+        profilerAddName(&b,binding->member);
+    }
+    luaL_pushresult(&b);
+}
+
+//add time to the stack on the top and pop it
+static void profilerRecord(lua_State *L, LuaJniProfiler *profiler, int64_t time){
+    lua_rawgeti(L,LUA_REGISTRYINDEX,profiler->samples);
+    lua_pushvalue(L,-2);
+    lua_rawget(L,-2);
+    lua_Integer total = lua_tointeger(L,-1) + time;
+    lua_pop(L,1);
+    lua_pushvalue(L,-2);
+    lua_pushinteger(L,total);
+    lua_rawset(L,-3);
+    lua_pop(L,2);
+}
+
+static void profilerSample(lua_State *L, LuaJniProfiler *profiler){
+    int64_t now = profilerNow();
+    int64_t time = now - profiler->last - profiler->bindingTime;
+    profiler->last = now;
+    profiler->bindingTime = 0;
+    if(time > 0 && lua_checkstack(L,5)){
+        profilerPushStack(L,NULL);
+        profilerRecord(L,profiler,time);
+    }
+}
+
+static void profilerEnter(LuaJniState *state, const char *className, const char *member){
+    LuaJniProfiler *profiler = state->profiler;
+    if(++profiler->calls < profiler->bindingInterval || profiler->count >= PROFILER_MAX_BINDINGS) return;
+    profiler->calls = 0;
+    ProfilerBinding *binding = &profiler->bindings[profiler->count++];
+    binding->className = className;
+    strncpy(binding->member,member,PROFILER_NAME_SIZE - 1);
+    binding->member[PROFILER_NAME_SIZE - 1] = '\0';
+    binding->depth = state->frameDepth;
+    binding->children = 0;
+    binding->start = profilerNow();
+}
+
+//close the sampled bindings whose frames have been popped
+static void profilerLeave(lua_State *L, LuaJniState *state){
+    LuaJniProfiler *profiler = state->profiler;
+    while(profiler && profiler->count > 0 && profiler->bindings[profiler->count - 1].depth > state->frameDepth){
+        ProfilerBinding *binding = &profiler->bindings[--profiler->count];
+        int64_t elapsed = profilerNow() - binding->start;
+        int64_t self = elapsed - binding->children;
+        if(profiler->count > 0){
+            profiler->bindings[profiler->count - 1].children += elapsed;
+        }else{
+            profiler->bindingTime += elapsed * profiler->bindingInterval;
+        }
+        if(self > 0 && lua_checkstack(L,5)){
+            profilerPushStack(L,binding);
+            profilerRecord(L,profiler,self * profiler->bindingInterval);
+        }
+    }
+}
+
+static const char *const abortMessages[] = {
+    NULL,
+    "instruction budget exceeded",
+    "deadline exceeded",
+    "call cancelled"
+};
+
+static void luaJniHook(lua_State *L, lua_Debug *ar);
+
+//the count hook is shared by the profiler and the budget, it fires every hookCount instructions,
+//once the call is aborted it fires on every instruction so pcall can not swallow the abort
+static void updateHook(lua_State *L, LuaJniState *state){
+    LuaJniBudget *budget = &state->budget;
+    int count = state->profiler ? state->profiler->interval : 0;
+    if(budget->active){
+        int check = LUA_JNI_BUDGET_CHECK_INTERVAL;
+        if(budget->instructions > 0 && budget->instructions < check){
+            check = (int) budget->instructions;
+        }
+        if(count == 0 || check < count) count = check;
+    }
+    if(budget->tripped) count = 1;
+    state->hookCount = count;
+    state->hookMask = count > 0 ? LUA_MASKCOUNT : 0;
+    lua_sethook(L,count > 0 ? luaJniHook : NULL,state->hookMask,count);
+}
+
+static void budgetAbort(lua_State *L, LuaJniState *state, int reason){
+    if(!state->budget.tripped){
+        state->budget.tripped = reason;
+        updateHook(L,state);
+    }
+    luaL_error(L,"%s",abortMessages[state->budget.tripped]);
+}
+
+static void luaJniHook(lua_State *L, lua_Debug *ar){
+    LuaJniState *state = getState(L);
+    LuaJniBudget *budget = &state->budget;
+    if(budget->calls > 0){
+        if(budget->tripped){
+            budgetAbort(L,state,budget->tripped);
+        }
+        if(__atomic_load_n(&budget->cancel,__ATOMIC_ACQUIRE) ||
+           (budget->parent && __atomic_load_n(budget->parent,__ATOMIC_ACQUIRE))){
+            budgetAbort(L,state,LUA_JNI_ABORT_CANCELLED);
+        }
+    }
+    //inherited by a coroutine created under another setting
+    if(ar->event != LUA_HOOKCOUNT || lua_gethookmask(L) != state->hookMask || lua_gethookcount(L) != state->hookCount){
+        updateHook(L,state);
+        return;
+    }
+    if(budget->active){
+        if(budget->instructions > 0){
+            int64_t left = budget->pool ? __atomic_sub_fetch(budget->pool,state->hookCount,__ATOMIC_RELAXED)
+                                        : (budget->remaining -= state->hookCount);
+            if(left <= 0){
+                budgetAbort(L,state,LUA_JNI_ABORT_INSTRUCTIONS);
             }
         }
+        if(budget->deadline > 0 && profilerNow() >= budget->deadline){
+            budgetAbort(L,state,LUA_JNI_ABORT_DEADLINE);
+        }
+    }
+    LuaJniProfiler *profiler = state->profiler;
+    if(profiler && (profiler->pending += state->hookCount) >= profiler->interval){
+        profiler->pending = 0;
+        profilerSample(L,profiler);
+    }
+}
+
+void luaJniSetCallBudget(lua_State *L, int64_t instructions, int64_t timeoutMillis) {
+    LuaJniBudget *budget = &getState(L)->budget;
+    budget->callInstructions = instructions;
+    budget->callTimeout = timeoutMillis;
+}
+
+int luaJniBeginCall(lua_State *L, int64_t instructions, int64_t timeoutMillis) {
+    LuaJniState *state = getState(L);
+    LuaJniBudget *budget = &state->budget;
+    if(budget->calls++ > 0) return 0;
+    __atomic_store_n(&budget->cancel,0,__ATOMIC_RELAXED);
+    budget->tripped = 0;
+    budget->instructions = instructions > 0 ? instructions : 0;
+    budget->remaining = budget->instructions;
+    budget->deadline = timeoutMillis > 0 ? profilerNow() + timeoutMillis * 1000000 : 0;
+    budget->active = budget->instructions > 0 || budget->deadline > 0;
+    if(budget->active || lua_gethookmask(L) != state->hookMask){
+        updateHook(L,state);
+    }
+    return 1;
+}
+
+void luaJniEndCall(lua_State *L, int owner) {
+    LuaJniState *state = getState(L);
+    LuaJniBudget *budget = &state->budget;
+    budget->calls--;
+    if(!owner) return;
+    int reset = budget->active || budget->tripped || lua_gethookmask(L) != state->hookMask;
+    budget->active = 0;
+    budget->tripped = 0;
+    __atomic_store_n(&budget->cancel,0,__ATOMIC_RELAXED);
+    if(reset){
+        updateHook(L,state);
+    }
+}
+
+//the workers draw from the remaining instructions of L instead of a copy each, so together they can not run
+//more than L had left, give or take one check interval per worker. L waits for the workers and does not run
+//its own hook meanwhile, so the count is only shared with other workers
+void luaJniShareBudget(lua_State *L, lua_State *worker) {
+    LuaJniBudget *budget = &getState(L)->budget;
+    LuaJniState *state = getState(worker);
+    LuaJniBudget *shared = &state->budget;
+    luaJniBeginCall(worker,0,0);
+    if(budget->active && budget->instructions > 0){
+        shared->instructions = budget->remaining > 0 ? budget->remaining : 1;
+        shared->pool = &budget->remaining;
+    }
+    shared->remaining = shared->instructions;
+    shared->deadline = budget->deadline;
+    shared->parent = &budget->cancel;
+    //always checked, the cancel of L has no other way to reach the worker
+    shared->active = 1;
+    updateHook(worker,state);
+}
+
+int luaJniUnshareBudget(lua_State *worker) {
+    LuaJniBudget *shared = &getState(worker)->budget;
+    int reason = shared->tripped;
+    shared->parent = NULL;
+    shared->pool = NULL;
+    luaJniEndCall(worker,1);
+    return reason;
+}
+
+void luaJniCheckBudget(lua_State *L, int reason) {
+    LuaJniState *state = getState(L);
+    LuaJniBudget *budget = &state->budget;
+    if(budget->calls == 0) return;
+    if(reason == 0 && __atomic_load_n(&budget->cancel,__ATOMIC_ACQUIRE)){
+        reason = LUA_JNI_ABORT_CANCELLED;
+    }
+    if(reason == 0 && budget->deadline > 0 && profilerNow() >= budget->deadline){
+        reason = LUA_JNI_ABORT_DEADLINE;
+    }
+    if(reason != 0){
+        budgetAbort(L,state,reason);
+    }
+}
+
+//only the flag is written here, the thread running the call owns the hook and acts on it
+void luaJniCancel(lua_State *L) {
+    __atomic_store_n(&getState(L)->budget.cancel,1,__ATOMIC_RELEASE);
+}
+
+//count hooks are per thread and only copied when a coroutine is created, so a coroutine created
+//while no hook was needed gets the current one when it is resumed
+static void syncHook(lua_State *L, lua_State *co){
+    LuaJniState *state = getState(L);
+    lua_Hook hook = state->hookMask ? luaJniHook : NULL;
+    if(lua_gethook(co) != hook || lua_gethookmask(co) != state->hookMask || lua_gethookcount(co) != state->hookCount){
+        lua_sethook(co,hook,state->hookMask,state->hookCount);
+    }
+}
+
+//the original function is the first upvalue, the thread to sync the second one or the first argument
+static int syncedResume(lua_State *L){
+    lua_State *co = lua_tothread(L,lua_isnone(L,lua_upvalueindex(2)) ? 1 : lua_upvalueindex(2));
+    if(co){
+        syncHook(L,co);
+    }
+    lua_pushvalue(L,lua_upvalueindex(1));
+    lua_insert(L,1);
+    int status = lua_pcall(L,lua_gettop(L) - 1,LUA_MULTRET,0);
+    //an abort inside the coroutine must not be swallowed by a pcall of the resumer
+    syncHook(L,L);
+    if(status != LUA_OK){
+        return lua_error(L);
+    }
+    return lua_gettop(L);
+}
+
+static int syncedWrap(lua_State *L){
+    lua_pushvalue(L,lua_upvalueindex(1));
+    lua_insert(L,1);
+    lua_call(L,lua_gettop(L) - 1,1);
+    //the coroutine is the only upvalue of the function returned by lua
+    if(lua_getupvalue(L,-1,1) == NULL){
+        return 1;
+    }
+    if(!lua_isthread(L,-1)){
+        lua_pop(L,1);
+        return 1;
+    }
+    lua_pushcclosure(L,syncedResume,2);
+    return 1;
+}
+
+static void syncCoroutines(lua_State *L){
+    if(lua_getglobal(L,"coroutine") == LUA_TTABLE){
+        lua_getfield(L,-1,"resume");
+        lua_pushcclosure(L,syncedResume,1);
+        lua_setfield(L,-2,"resume");
+        lua_getfield(L,-1,"wrap");
+        lua_pushcclosure(L,syncedWrap,1);
+        lua_setfield(L,-2,"wrap");
+    }
+    lua_pop(L,1);
+}
+
+void luaJniStartProfiler(lua_State *L, int instructionInterval, int bindingInterval) {
+    LuaJniState *state = getState(L);
+    if(state->profiler == NULL){
+        state->profiler = (LuaJniProfiler *) calloc(1,sizeof(LuaJniProfiler));
+        lua_newtable(L);
+        state->profiler->samples = luaL_ref(L,LUA_REGISTRYINDEX);
+    }
+    state->profiler->interval = instructionInterval > 0 ? instructionInterval : 1;
+    state->profiler->pending = 0;
+    state->profiler->bindingInterval = bindingInterval > 0 ? bindingInterval : 1;
+    state->profiler->calls = 0;
+    profilerReset(state);
+    updateHook(L,state);
+}
+
+void luaJniStopProfiler(lua_State *L) {
+    LuaJniState *state = getState(L);
+    LuaJniProfiler *profiler = state->profiler;
+    if(profiler == NULL){
+        lua_pushliteral(L,"");
+        return;
+    }
+    state->profiler = NULL;
+    updateHook(L,state);
+    lua_rawgeti(L,LUA_REGISTRYINDEX,profiler->samples);
+    luaL_unref(L,LUA_REGISTRYINDEX,profiler->samples);
+    free(profiler);
+    int samples = lua_gettop(L);
+    lua_newtable(L);
+    int lines = lua_gettop(L);
+    int count = 0;
+    lua_pushnil(L);
+    while(lua_next(L,samples)){
+        lua_pushfstring(L,"%s %I\n",lua_tostring(L,-2),lua_tointeger(L,-1));
+        lua_rawseti(L,lines,++count);
+        lua_pop(L,1);
+    }
+    luaL_Buffer b;
+    luaL_buffinit(L,&b);
+    for(int i = 1; i <= count; i++){
+        lua_rawgeti(L,lines,i);
+        luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+    lua_replace(L,samples);
+    lua_settop(L,samples);
+}
+
+static LuaJniBindingStats *statsList = NULL;
+
+LuaJniBindingStats* luaJniBindingStatsList(void) {
+    return __atomic_load_n(&statsList,__ATOMIC_ACQUIRE);
+}
+
+LuaJniBindingStats* luaJniFindBindingStats(LuaJniBindingStats *stats, int count, const char *member) {
+    int low = 0;
+    int high = count - 2;
+    while(low <= high){
+        int middle = (low + high) / 2;
+        int r = strcmp(member,stats[middle].member);
+        if(r == 0) return &stats[middle];
+        if(r < 0) high = middle - 1;
+        else low = middle + 1;
+    }
+    return &stats[count - 1];
+}
+
+static void statsEnter(LuaJniState *state, LuaJniBindingStats *stats){
+    if(!__atomic_load_n(&stats->registered,__ATOMIC_ACQUIRE) &&
+       !__atomic_exchange_n(&stats->registered,1,__ATOMIC_ACQ_REL)){
+        LuaJniBindingStats *head = __atomic_load_n(&statsList,__ATOMIC_RELAXED);
+        do{
+            stats->next = head;
+        }while(!__atomic_compare_exchange_n(&statsList,&head,stats,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+    }
+    if(state->statsCount >= STATS_MAX_FRAMES){
+        __atomic_add_fetch(&stats->calls,1,__ATOMIC_RELAXED);
+        return;
+    }
+    StatsFrame *frame = &state->statsFrames[state->statsCount++];
+    frame->stats = stats;
+    frame->depth = state->frameDepth;
+    frame->start = profilerNow();
+}
+
+static void statsLeave(LuaJniState *state){
+    while(state->statsCount > 0 && state->statsFrames[state->statsCount - 1].depth > state->frameDepth){
+        StatsFrame *frame = &state->statsFrames[--state->statsCount];
+        uint64_t elapsed = (uint64_t) (profilerNow() - frame->start);
+        int bucket = elapsed > 1 ? 63 - __builtin_clzll(elapsed) : 0;
+        if(bucket >= LUA_JNI_STATS_BUCKETS) bucket = LUA_JNI_STATS_BUCKETS - 1;
+        __atomic_add_fetch(&frame->stats->calls,1,__ATOMIC_RELAXED);
+        __atomic_add_fetch(&frame->stats->histogram[bucket],1,__ATOMIC_RELAXED);
+    }
+}
+
+void luaJniGetGauges(lua_State *L, LuaJniGauges *gauges) {
+    LuaJniState *state = getState(L);
+    gauges->globalRefs = __atomic_load_n(&globalRefs,__ATOMIC_RELAXED);
+    gauges->handlesCreated = __atomic_load_n(&handlesCreated,__ATOMIC_RELAXED);
+    gauges->handlesCollected = __atomic_load_n(&handlesCollected,__ATOMIC_RELAXED);
+    gauges->luaHeapBytes = (int64_t) lua_gc(L,LUA_GCCOUNT) * 1024 + lua_gc(L,LUA_GCCOUNTB);
+    gauges->callbacks = 0;
+    pthread_mutex_lock(&callbackLock);
+    for(LuaJniCallback *callback = state->callbacks; callback; callback = callback->next){
+        gauges->callbacks++;
+    }
+    pthread_mutex_unlock(&callbackLock);
+    gauges->frameDepth = state->frameDepth;
+}
+
+static void gcCheckPressure(lua_State *L, LuaJniState *state){
+    GcPressure *gc = &state->gc;
+    if(gc->stepBytes <= 0) return;
+    int64_t created = gc->handlesCreated;
+    int64_t debt = gc->debt + (created - gc->handleMark) * gc->handleBytes;
+    if(debt < gc->stepBytes) return;
+    gc->handleMark = created;
+    gc->debt = 0;
+    if(gc->liveHandles <= gc->globalRefLimit){
+        gc->collectLimit = gc->globalRefLimit;
+    }
+    if(gc->globalRefLimit > 0 && gc->liveHandles > gc->collectLimit){
+        LOGD("global refs over %lld, full collection\n",(long long) gc->collectLimit);
+        lua_gc(L,LUA_GCCOLLECT);
+        //what survives is held by the script, collecting again only pays off after a quarter of the limit more
+        if(gc->liveHandles > gc->globalRefLimit){
+            gc->collectLimit = gc->liveHandles + gc->globalRefLimit / 4;
+        }
+    }else{
+        lua_gc(L,LUA_GCSTEP,(int) (debt / 1024));
+    }
+}
+
+void luaJniSetGcPolicy(lua_State *L, int64_t handleBytes, int64_t stepBytes, int64_t globalRefLimit, int generational) {
+    GcPressure *gc = &getState(L)->gc;
+    gc->handleBytes = handleBytes;
+    gc->stepBytes = stepBytes;
+    gc->globalRefLimit = globalRefLimit;
+    gc->collectLimit = globalRefLimit;
+    gc->handleMark = gc->handlesCreated;
+    gc->debt = 0;
+    if(generational){
+        lua_gc(L,LUA_GCGEN,0,0);
+    }else{
+        lua_gc(L,LUA_GCINC,0,0,0);
+    }
+}
+
+int luaJniSetSizeEstimate(lua_State *L, const char *className, int64_t bytes) {
+    if(!luaL_getmetatable(L,className)){
+        lua_pop(L,1);
+        return 0;
+    }
+    lua_pushinteger(L,bytes);
+    lua_setfield(L,-2,GC_SIZE_FIELD);
+    lua_pop(L,1);
+    getState(L)->gc.sizeEstimates = 1;
+    return 1;
+}
+
+//the proxy of a function is only held weakly, so the cache does not keep the java object alive
+typedef struct CallbackCacheEntry{
+    jweak proxy;
+    const char *key;
+    LuaJniCallback *callback;
+}CallbackCacheEntry;
+
+static int callbackCacheEntryGc(lua_State *L){
+    CallbackCacheEntry *entry = (CallbackCacheEntry *) lua_touserdata(L,1);
+    JNIEnv *env = getState(L)->env;
+    if(entry->proxy && env){
+        (*env)->DeleteWeakGlobalRef(env,entry->proxy);
+        entry->proxy = NULL;
+    }
+    return 0;
+}
+
+//push the weak keyed table mapping a lua function to its CallbackCacheEntry
+static void pushCallbackCache(lua_State *L){
+    if(lua_getfield(L,LUA_REGISTRYINDEX,CALLBACK_CACHE_KEY) == LUA_TTABLE) return;
+    lua_pop(L,1);
+    lua_newtable(L);
+    lua_createtable(L,0,1);
+    lua_pushliteral(L,"k");
+    lua_setfield(L,-2,"__mode");
+    lua_setmetatable(L,-2);
+    lua_pushvalue(L,-1);
+    lua_setfield(L,LUA_REGISTRYINDEX,CALLBACK_CACHE_KEY);
+}
+
+//forget the cached proxy of a released callback before its function ref is dropped
+static void uncacheCallback(lua_State *L, LuaJniCallback *callback){
+    pushCallbackCache(L);
+    lua_rawgeti(L,LUA_REGISTRYINDEX,callback->ref);
+    lua_pushvalue(L,-1);
+    lua_rawget(L,-3);
+    CallbackCacheEntry *entry = (CallbackCacheEntry *) lua_touserdata(L,-1);
+    lua_pop(L,1);
+    if(entry && entry->callback == callback){
+        lua_pushnil(L);
+        lua_rawset(L,-3);
+        lua_pop(L,1);
+    }else{
+        lua_pop(L,2);
+    }
+}
+
+static void drainReleasedCallbacks(lua_State *L, LuaJniState *state){
+    if(__atomic_load_n(&state->releasedCallbacks,__ATOMIC_ACQUIRE) == NULL) return;
+    pthread_mutex_lock(&callbackLock);
+    LuaJniCallback *callback = state->releasedCallbacks;
+    state->releasedCallbacks = NULL;
+    pthread_mutex_unlock(&callbackLock);
+    while(callback){
+        LuaJniCallback *next = callback->next;
+        uncacheCallback(L,callback);
+        luaL_unref(L,LUA_REGISTRYINDEX,callback->ref);
+        free(callback);
+        callback = next;
+    }
+}
+
+LuaJniCallback* luaJniNewCallback(lua_State *L, int index) {
+    LuaJniState *state = getState(L);
+    drainReleasedCallbacks(L,state);
+    LuaJniCallback *callback = (LuaJniCallback *) malloc(sizeof(LuaJniCallback));
+    lua_pushvalue(L,index);
+    callback->ref = luaL_ref(L,LUA_REGISTRYINDEX);
+    //L may be a coroutine which is suspended or collected when the proxy is called
+    lua_rawgeti(L,LUA_REGISTRYINDEX,LUA_RIDX_MAINTHREAD);
+    callback->L = lua_tothread(L,-1);
+    lua_pop(L,1);
+    callback->state = state;
+    callback->released = 0;
+    callback->prev = NULL;
+    pthread_mutex_lock(&callbackLock);
+    callback->next = state->callbacks;
+    if(state->callbacks){
+        state->callbacks->prev = callback;
+    }
+    state->callbacks = callback;
+    pthread_mutex_unlock(&callbackLock);
+    return callback;
+}
+
+jobject luaJniFindCallback(lua_State *L, JNIEnv *env, int index, const char *key) {
+    index = lua_absindex(L,index);
+    drainReleasedCallbacks(L,getState(L));
+    if(lua_getfield(L,LUA_REGISTRYINDEX,CALLBACK_CACHE_KEY) != LUA_TTABLE){
+        lua_pop(L,1);
+        return NULL;
+    }
+    lua_pushvalue(L,index);
+    lua_rawget(L,-2);
+    CallbackCacheEntry *entry = (CallbackCacheEntry *) lua_touserdata(L,-1);
+    lua_pop(L,2);
+    //a callback released after the drain is still allocated, it is only freed by this thread
+    if(entry == NULL || entry->key != key || __atomic_load_n(&entry->callback->released,__ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    return (*env)->NewLocalRef(env,entry->proxy);
+}
+
+void luaJniCacheCallback(lua_State *L, JNIEnv *env, int index, const char *key, LuaJniCallback *callback, jobject proxy) {
+    index = lua_absindex(L,index);
+    pushCallbackCache(L);
+    lua_pushvalue(L,index);
+    CallbackCacheEntry *entry = (CallbackCacheEntry *) lua_newuserdata(L,sizeof(CallbackCacheEntry));
+    entry->proxy = (*env)->NewWeakGlobalRef(env,proxy);
+    entry->key = key;
+    entry->callback = callback;
+    if(luaL_newmetatable(L,CALLBACK_ENTRY_META_NAME)){
+        lua_pushcfunction(L,callbackCacheEntryGc);
+        lua_setfield(L,-2,"__gc");
+    }
+    lua_setmetatable(L,-2);
+    lua_rawset(L,-3);
+    lua_pop(L,1);
+}
+
+static void throwIllegalState(JNIEnv *env, const char *message){
+    jclass clazz = (*env)->FindClass(env,"java/lang/IllegalStateException");
+    (*env)->ThrowNew(env,clazz,message);
+    (*env)->DeleteLocalRef(env,clazz);
+}
+
+lua_State* luaJniCallbackEnter(JNIEnv *env, LuaJniCallback *callback, JNIEnv **savedEnv) {
+    pthread_mutex_lock(&callbackLock);
+    LuaJniState *state = callback->state;
+    int owned = state != NULL && pthread_equal(__atomic_load_n(&state->owner,__ATOMIC_ACQUIRE),pthread_self());
+    pthread_mutex_unlock(&callbackLock);
+    if(state == NULL){
+        throwIllegalState(env,"LuaInterpreter has been destroyed.");
+        return NULL;
+    }
+    //the lua_State is not thread safe, only the thread running the interpreter may enter it
+    if(!owned){
+        throwIllegalState(env,"LuaCallback called from a thread which does not own the LuaInterpreter.");
+        return NULL;
+    }
+    lua_State *L = callback->L;
+    *savedEnv = state->env;
+    state->env = env;
+    if(state->frameDepth == 0){
+        profilerReset(state);
+    }
+    drainReleasedCallbacks(L,state);
+    lua_rawgeti(L,LUA_REGISTRYINDEX,callback->ref);
+    return L;
+}
+
+int luaJniCallbackCall(lua_State *L, JNIEnv *env, int nargs, int nresults) {
+    LuaJniBudget *budget = &getState(L)->budget;
+    int owner = luaJniBeginCall(L,budget->callInstructions,budget->callTimeout);
+    int depth = luaJniLocalFrameDepth(L);
+    int r = lua_pcall(L,nargs,nresults,0);
+    luaJniPopLocalFrames(L,env,depth);
+    if(r != LUA_OK){
+        luaJniThrowLuaErrorAt(L,env,-1);
+    }
+    luaJniEndCall(L,owner);
+    return r == LUA_OK;
+}
+
+void luaJniThrowLuaError(JNIEnv *env, const char *message) {
+    jclass clazz = (*env)->FindClass(env,LUA_ERROR_CLASS);
+    (*env)->ThrowNew(env,clazz,message);
+    (*env)->DeleteLocalRef(env,clazz);
+}
+
+static void throwAbortError(lua_State *L, JNIEnv *env, int index, int reason) {
+    const char *message = lua_type(L,index) == LUA_TSTRING ? lua_tostring(L,index) : abortMessages[reason];
+    jstring jmessage = (*env)->NewStringUTF(env,message);
+    jclass clazz = (*env)->FindClass(env,LUA_ABORT_ERROR_CLASS);
+    jmethodID init = (*env)->GetMethodID(env,clazz,"<init>","(Ljava/lang/String;I)V");
+    jthrowable error = (jthrowable)(*env)->NewObject(env,clazz,init,jmessage,reason);
+    if(error){
+        (*env)->Throw(env,error);
+        (*env)->DeleteLocalRef(env,error);
+    }
+    (*env)->DeleteLocalRef(env,jmessage);
+    (*env)->DeleteLocalRef(env,clazz);
+}
+
+void luaJniThrowLuaErrorAt(lua_State *L, JNIEnv *env, int index) {
+    int reason = getState(L)->budget.tripped;
+    if(reason){
+        throwAbortError(L,env,index,reason);
+        return;
+    }
+    JavaObject *object = (JavaObject *) luaL_testudata(L,index,JAVA_THROWABLE_META_NAME);
+    if(object == NULL){
+        const char *message = lua_tostring(L,index);
+        luaJniThrowLuaError(env,message ? message : "lua error");
+        return;
+    }
+    jthrowable throwable = (jthrowable)luaJniTakeObject(env,object->id);
+    jstring message = (jstring)(*env)->CallObjectMethod(env,throwable,context->toString);
+    if((*env)->ExceptionCheck(env)){
+        (*env)->ExceptionClear(env);
+        message = NULL;
+    }
+    if(message == NULL){
+        message = (*env)->NewStringUTF(env,PUSH_THROWABLE_ERROR);
+    }
+    jclass clazz = (*env)->FindClass(env,LUA_ERROR_CLASS);
+    jmethodID init = (*env)->GetMethodID(env,clazz,"<init>","(Ljava/lang/String;Ljava/lang/Throwable;)V");
+    jthrowable error = (jthrowable)(*env)->NewObject(env,clazz,init,message,throwable);
+    luaJniPutBackObject(env,throwable);
+    if(error){
+        (*env)->Throw(env,error);
+        (*env)->DeleteLocalRef(env,error);
+    }
+    (*env)->DeleteLocalRef(env,message);
+    (*env)->DeleteLocalRef(env,clazz);
+}
+
+void luaJniCallbackLeave(lua_State *L, JNIEnv *savedEnv, int top) {
+    lua_settop(L,top);
+    getState(L)->env = savedEnv;
+}
+
+int luaJniPushLocalFrame(lua_State *L, JNIEnv *env, int capacity) {
+    if((*env)->PushLocalFrame(env,capacity) != 0){
+        luaJniCatchJavaAndThrowLuaException(L,env);
+        return 0;
     }
-    luaJniPutBackObject(env,obj);
-    return 0;
+    getState(L)->frameDepth++;
+    return 1;
+}
 
+int luaJniPushBindingFrame(lua_State *L, JNIEnv *env, int capacity, const char *className, const char *member) {
+    LuaJniState *state = getState(L);
+    //without a budget no hook runs, so a cancel is seen at the next binding
+    if(state->budget.calls > 0 && (state->budget.tripped || __atomic_load_n(&state->budget.cancel,__ATOMIC_ACQUIRE))){
+        budgetAbort(L,state,state->budget.tripped ? state->budget.tripped : LUA_JNI_ABORT_CANCELLED);
+    }
+    if(!luaJniPushLocalFrame(L,env,capacity)){
+        return 0;
+    }
+    if(state->profiler){
+        profilerEnter(state,className,member);
+    }
+    return 1;
 }
-static int javaArrayLen(lua_State*L){
-    JavaArray *array = (JavaArray *) luaL_checkudata(L,1,JAVA_ARRAY_META_NAME);
-    JNIEnv *env = luaJniGetEnv(L);
-    jobject obj = luaJniTakeObject(env,array->id);
-    jint length = (*env)->GetArrayLength(env,obj);
-    if(luaJniCatchJavaException(L, env)){
-        luaJniPutBackObject(env,obj);
-        lua_error(L);
+
+int luaJniPushStatsFrame(lua_State *L, JNIEnv *env, int capacity, LuaJniBindingStats *stats) {
+    if(!luaJniPushBindingFrame(L,env,capacity,stats->className,stats->member)){
+        return 0;
     }
-    lua_pushinteger(L,length);
-    luaJniPutBackObject(env,obj);
+    statsEnter(getState(L),stats);
     return 1;
 }
 
+void luaJniPopLocalFrame(lua_State *L, JNIEnv *env) {
+    LuaJniState *state = getState(L);
+    if(state->frameDepth > 0){
+        state->frameDepth--;
+        (*env)->PopLocalFrame(env,NULL);
+    }
+    if(state->statsCount > 0){
+        statsLeave(state);
+    }
+    if(state->profiler){
+        profilerLeave(L,state);
+    }
+    gcCheckPressure(L,state);
+}
+
+int luaJniFlushLocalFrame(lua_State *L, JNIEnv *env, int capacity) {
+    luaJniPopLocalFrame(L,env);
+    return luaJniPushLocalFrame(L,env,capacity);
+}
+
+int luaJniLocalFrameDepth(lua_State *L) {
+    return getState(L)->frameDepth;
+}
+
+void luaJniPopLocalFrames(lua_State *L, JNIEnv *env, int depth) {
+    LuaJniState *state = getState(L);
+    while(state->frameDepth > depth){
+        state->frameDepth--;
+        (*env)->PopLocalFrame(env,NULL);
+    }
+    if(state->statsCount > 0){
+        statsLeave(state);
+    }
+    if(state->profiler){
+        profilerLeave(L,state);
+    }
+}
+
+void luaJniReleaseCallback(LuaJniCallback *callback) {
+    pthread_mutex_lock(&callbackLock);
+    __atomic_store_n(&callback->released,1,__ATOMIC_RELEASE);
+    LuaJniState *state = callback->state;
+    if(state == NULL){
+        pthread_mutex_unlock(&callbackLock);
+        free(callback);
+        return;
+    }
+    if(callback->prev){
+        callback->prev->next = callback->next;
+    }else{
+        state->callbacks = callback->next;
+    }
+    if(callback->next){
+        callback->next->prev = callback->prev;
+    }
+    callback->prev = NULL;
+    callback->next = state->releasedCallbacks;
+    __atomic_store_n(&state->releasedCallbacks,callback,__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&callbackLock);
+}
+
+void luaJniSetEnv(lua_State *L, JNIEnv *env) {
+    LuaJniState *state = getState(L);
+    state->env = env;
+    __atomic_store_n(&state->owner,pthread_self(),__ATOMIC_RELEASE);
+    profilerReset(state);
+    drainReleasedCallbacks(L,state);
+}
+
+void luaJniCloseLua(lua_State *L) {
+    LuaJniState *state = getState(L);
+    pthread_mutex_lock(&callbackLock);
+    for(LuaJniCallback *callback = state->callbacks; callback; callback = callback->next){
+        callback->state = NULL;
+    }
+    LuaJniCallback *released = state->releasedCallbacks;
+    state->callbacks = NULL;
+    state->releasedCallbacks = NULL;
+    pthread_mutex_unlock(&callbackLock);
+    while(released){
+        LuaJniCallback *next = released->next;
+        free(released);
+        released = next;
+    }
+    lua_close(L);
+    free(state->profiler);
+    free(state);
+}
+
 void luaJniInitLua(lua_State *L, JNIEnv *env) {
+    LuaJniState *state = (LuaJniState *) malloc(sizeof(LuaJniState));
+    memset(state,0,sizeof(LuaJniState));
+    state->env = env;
+    state->owner = pthread_self();
+    *(LuaJniState **) lua_getextraspace(L) = state;
+    luaJniSetGcPolicy(L,LUA_JNI_GC_HANDLE_BYTES,LUA_JNI_GC_STEP_BYTES,LUA_JNI_GC_GLOBAL_REF_LIMIT,0);
     if(luaL_newmetatable(L,JAVA_ARRAY_META_NAME)){
         luaL_Reg methods[] = {
             {"__index",    javaArrayIndex},
             {"__newindex", javaArrayNewIndex},
             {"__gc",       luaJniJavaObjectGc},
             {"__len",      javaArrayLen},
+            {"__pairs",    javaArrayPairs},
+            {NULL,NULL}
+        };
+        luaL_setfuncs(L,methods,0);
+    }
+    lua_pop(L,1);
+    if(luaL_newmetatable(L,JAVA_ARRAY_ROWS_META_NAME)){
+        lua_pushliteral(L,"v");
+        lua_setfield(L,-2,"__mode");
+    }
+    lua_pop(L,1);
+    if(luaL_newmetatable(L,JAVA_ITERATOR_META_NAME)){
+        lua_pushcfunction(L,javaIteratorGc);
+        lua_setfield(L,-2,"__gc");
+    }
+    lua_pop(L,1);
+    if(luaL_newmetatable(L,JAVA_THROWABLE_META_NAME)){
+        luaL_Reg methods[] = {
+            {"__index",    javaThrowableIndex},
+            {"__tostring", javaThrowableToString},
+            {"__gc",       luaJniJavaObjectGc},
             {NULL,NULL}
         };
         luaL_setfuncs(L,methods,0);
     }
     lua_pop(L,1);
+    syncCoroutines(L);
+    luaL_Reg lib[] = {
+        {"parallel", luaJniParallel},
+        {"iter",     javaIter},
+        {NULL,NULL}
+    };
+    lua_newtable(L);
+    luaL_setfuncs(L,lib,0);
+    lua_setglobal(L,"luajni");
+}
+
+void luaJniSetLazyExceptions(lua_State *L, int lazy) {
+    getState(L)->lazyExceptions = lazy;
 }
 
 int luaJniInject(lua_State *L, JNIEnv *env,const char*name) {
@@ -549,17 +2222,9 @@ int luaJniPush##staticStr##ObjectField(lua_State*L,JNIEnv*env,j##type a_##type,j
     jobject value = (*env)->Get##staticStr##ObjectField(env,a_##type,field);\
     if(luaJniCatchJavaException(L, env)) return 0;\
     if(value != NULL){\
-        int64_t id = luaJniCacheObject(env, value);\
+        int r = luaJniPushObject(L,env,value,className);\
         (*env)->DeleteLocalRef(env,value);\
-        JavaObject *object = (JavaObject *) lua_newuserdata(L,sizeof(JavaObject));\
-        object->id = id;\
-        int r = luaL_getmetatable(L,className);\
-        if(r){\
-            lua_setmetatable(L,-2);\
-        }else{\
-            lua_pushfstring(L,"can not find metatable for %s",className);\
-            return 0;\
-        }\
+        if(!r) return 0;\
     }else{\
         lua_pushnil(L);\
     }\
@@ -570,6 +2235,100 @@ LUA_JNI_PUSH_OBJECT_FIELD(object,)
 LUA_JNI_PUSH_OBJECT_FIELD(class,Static)
 #undef LUA_JNI_PUSH_OBJECT_FIELD
 
+//names are in declaration order, which is the ordinal order of values()
+int luaJniInitEnum(JNIEnv *env, LuaJniEnum *e, jclass clazz) {
+    jclass classClass = (*env)->GetObjectClass(env,clazz);
+    jmethodID getEnumConstants = (*env)->GetMethodID(env,classClass,"getEnumConstants","()[Ljava/lang/Object;");
+    (*env)->DeleteLocalRef(env,classClass);
+    jobjectArray constants = (jobjectArray)(*env)->CallObjectMethod(env,clazz,getEnumConstants);
+    if((*env)->ExceptionCheck(env) || constants == NULL){
+        (*env)->ExceptionClear(env);
+        return 0;
+    }
+    jsize count = (*env)->GetArrayLength(env,constants);
+    if(count != e->count){
+        LOGW("enum %s has %d constants, %d are generated \n",e->className,(int) count,e->count);
+        if(count < e->count) e->count = count;
+    }
+    jclass enumClass = (*env)->FindClass(env,"java/lang/Enum");
+    e->ordinal = (*env)->GetMethodID(env,enumClass,"ordinal","()I");
+    (*env)->DeleteLocalRef(env,enumClass);
+    jobject *values = (jobject *) malloc(sizeof(jobject) * (e->count > 0 ? e->count : 1));
+    for(int i = 0; i < e->count; i++){
+        jobject value = (*env)->GetObjectArrayElement(env,constants,i);
+        values[i] = (*env)->NewGlobalRef(env,value);
+        (*env)->DeleteLocalRef(env,value);
+    }
+    (*env)->DeleteLocalRef(env,constants);
+    e->values = values;
+    return 1;
+}
+
+void luaJniReleaseEnum(JNIEnv *env, LuaJniEnum *e) {
+    if(e->values == NULL) return;
+    for(int i = 0; i < e->count; i++){
+        (*env)->DeleteGlobalRef(env,e->values[i]);
+    }
+    free(e->values);
+    e->values = NULL;
+}
+
+//small enums are matched by identity, larger ones ask for the ordinal
+#define ENUM_IDENTITY_SCAN 8
+
+int luaJniPushEnum(lua_State *L, JNIEnv *env, const LuaJniEnum *e, jobject value) {
+    if(value == NULL){
+        lua_pushnil(L);
+        return 1;
+    }
+    if(e->values == NULL){
+        lua_pushfstring(L,"enum %s is not registered",e->className);
+        return 0;
+    }
+    jint ordinal = -1;
+    if(e->count <= ENUM_IDENTITY_SCAN){
+        for(int i = 0; i < e->count; i++){
+            if((*env)->IsSameObject(env,value,e->values[i])){
+                ordinal = i;
+                break;
+            }
+        }
+    }else{
+        ordinal = (*env)->CallIntMethod(env,value,e->ordinal);
+        if(luaJniCatchJavaException(L,env)) return 0;
+    }
+    if(ordinal < 0 || ordinal >= e->count){
+        lua_pushfstring(L,"unknown constant of %s",e->className);
+        return 0;
+    }
+    lua_pushstring(L,e->names[ordinal]);
+    return 1;
+}
+
+int luaJniEnumIndex(lua_State *L, int index, const LuaJniEnum *e) {
+    if(e->values == NULL || lua_type(L,index) != LUA_TSTRING) return -1;
+    const char *name = lua_tostring(L,index);
+    for(int i = 0; i < e->count; i++){
+        if(strcmp(name,e->names[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+#define LUA_JNI_PUSH_ENUM_FIELD(type,staticStr)\
+int luaJniPush##staticStr##EnumField(lua_State*L,JNIEnv*env,j##type a_##type,jfieldID field,const LuaJniEnum*e){\
+    jobject value = (*env)->Get##staticStr##ObjectField(env,a_##type,field);\
+    if(luaJniCatchJavaException(L, env)) return 0;\
+    int r = luaJniPushEnum(L,env,e,value);\
+    if(value) (*env)->DeleteLocalRef(env,value);\
+    return r;\
+}
+
+LUA_JNI_PUSH_ENUM_FIELD(object,)
+LUA_JNI_PUSH_ENUM_FIELD(class,Static)
+#undef LUA_JNI_PUSH_ENUM_FIELD
+
 
 #define LUA_JNI_PUSH_ARRAY_FIELD(type,staticStr)\
 int luaJniPush##staticStr##ArrayField(lua_State*L,JNIEnv*env,j##type a_##type,jfieldID field,const char*className,int level,\
@@ -577,13 +2336,8 @@ int luaJniPush##staticStr##ArrayField(lua_State*L,JNIEnv*env,j##type a_##type,jf
     jobjectArray value = (*env)->Get##staticStr##ObjectField(env,a_##type,field);\
     if(luaJniCatchJavaException(L, env)) return 0;\
     if(value != NULL){\
-        JavaArray *array = (JavaArray *) lua_newuserdata(L,sizeof(JavaArray));\
-        array->id = (int64_t)value;\
-        array->level = level;\
-        array->name = className;\
-        array->elementType = elementType;\
-        luaL_getmetatable(L,JAVA_ARRAY_META_NAME);\
-        lua_setmetatable(L,-2);\
+        luaJniPushArray(L,env,value,level,className,elementType);\
+        (*env)->DeleteLocalRef(env,value);\
     }else{\
         lua_pushnil(L);\
     }\
@@ -595,6 +2349,573 @@ LUA_JNI_PUSH_ARRAY_FIELD(class,Static)
 
 
 
+typedef struct ClassRuntime{
+    const LuaJniClassDescriptor *descriptor;
+    int64_t id;
+    jmethodID defaultConstructor;
+    int constructorStart;
+    int constructorCount;
+    const LuaJniMemberDescriptor **members;
+    void **ids;
+    LuaJniBindingStats *stats;
+}ClassRuntime;
+
+static int compareMember(const void *a, const void *b){
+    const LuaJniMemberDescriptor *x = *(const LuaJniMemberDescriptor **) a;
+    const LuaJniMemberDescriptor *y = *(const LuaJniMemberDescriptor **) b;
+    int r = strcmp(x->name,y->name);
+    if(r != 0) return r;
+    if(x->kind != y->kind) return x->kind < y->kind ? -1 : 1;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int descriptorFind(ClassRuntime *runtime, const char *name, enum LUA_JNI_MEMBER_KIND kind, int *count){
+    int low = 0;
+    int high = runtime->descriptor->memberCount;
+    while(low < high){
+        int middle = (low + high) / 2;
+        const LuaJniMemberDescriptor *member = runtime->members[middle];
+        int r = strcmp(member->name,name);
+        if(r < 0 || (r == 0 && member->kind < kind)){
+            low = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
+    int end = low;
+    while(end < runtime->descriptor->memberCount &&
+          runtime->members[end]->kind == kind &&
+          strcmp(runtime->members[end]->name,name) == 0){
+        end++;
+    }
+    *count = end - low;
+    return low;
+}
+
+static int descriptorMatch(lua_State *L, int index, const LuaJniTypeDescriptor *type){
+    switch (type->type) {
+        case VALUE_BOOLEAN:
+            return lua_isboolean(L,index);
+        case VALUE_BYTE:
+        case VALUE_CHAR:
+        case VALUE_SHORT:
+        case VALUE_INT:
+        case VALUE_LONG:
+            return lua_isinteger(L,index);
+        case VALUE_FLOAT:
+        case VALUE_DOUBLE:
+            return lua_isnumber(L,index);
+        case VALUE_STRING:
+            return lua_isnil(L,index) || lua_type(L,index) == LUA_TSTRING;
+        case VALUE_WRAPPER_BOOLEAN:
+            return lua_isnil(L,index) || lua_isboolean(L,index);
+        case VALUE_WRAPPER_BYTE:
+        case VALUE_WRAPPER_CHAR:
+        case VALUE_WRAPPER_SHORT:
+        case VALUE_WRAPPER_INT:
+        case VALUE_WRAPPER_LONG:
+            return lua_isnil(L,index) || lua_isinteger(L,index);
+        case VALUE_WRAPPER_FLOAT:
+        case VALUE_WRAPPER_DOUBLE:
+            return lua_isnil(L,index) || lua_isnumber(L,index);
+        case VALUE_ARRAY:
+            return lua_isnil(L,index) || luaL_testudata(L,index,JAVA_ARRAY_META_NAME) != NULL;
+        case VALUE_CALLBACK:
+            return lua_isnil(L,index) || lua_isfunction(L,index) || luaL_testudata(L,index,type->className) != NULL;
+        case VALUE_OBJECT:
+            return lua_isnil(L,index) || luaL_testudata(L,index,type->className) != NULL;
+        default:
+            return 0;
+    }
+}
+
+static int descriptorMatchArgs(lua_State *L, const LuaJniMemberDescriptor *member, int origin){
+    if(lua_gettop(L) != member->argCount + origin - 1) return 0;
+    for(int i = 0; i < member->argCount; i++){
+        if(!descriptorMatch(L,origin + i,&member->args[i])) return 0;
+    }
+    return 1;
+}
+
+//the local references are released with the local frame of the caller
+static void descriptorToJava(lua_State *L, JNIEnv *env, int index, const LuaJniTypeDescriptor *type, jvalue *value){
+    value->j = 0;
+    switch (type->type) {
+        case VALUE_BOOLEAN: value->z = (jboolean) lua_toboolean(L,index); return;
+        case VALUE_BYTE: value->b = (jbyte) lua_tointeger(L,index); return;
+        case VALUE_CHAR: value->c = (jchar) lua_tointeger(L,index); return;
+        case VALUE_SHORT: value->s = (jshort) lua_tointeger(L,index); return;
+        case VALUE_INT: value->i = (jint) lua_tointeger(L,index); return;
+        case VALUE_LONG: value->j = (jlong) lua_tointeger(L,index); return;
+        case VALUE_FLOAT: value->f = (jfloat) lua_tonumber(L,index); return;
+        case VALUE_DOUBLE: value->d = (jdouble) lua_tonumber(L,index); return;
+        default: break;
+    }
+    if(lua_isnoneornil(L,index)){
+        value->l = NULL;
+        return;
+    }
+    switch (type->type) {
+        case VALUE_STRING:
+            value->l = (*env)->NewStringUTF(env,lua_tostring(L,index));
+            return;
+        case VALUE_WRAPPER_BOOLEAN: value->l = luaJniNewBoolean(env,(jboolean) lua_toboolean(L,index)); return;
+        case VALUE_WRAPPER_BYTE: value->l = luaJniNewByte(env,(jbyte) lua_tointeger(L,index)); return;
+        case VALUE_WRAPPER_CHAR: value->l = luaJniNewChar(env,(jchar) lua_tointeger(L,index)); return;
+        case VALUE_WRAPPER_SHORT: value->l = luaJniNewShort(env,(jshort) lua_tointeger(L,index)); return;
+        case VALUE_WRAPPER_INT: value->l = luaJniNewInt(env,(jint) lua_tointeger(L,index)); return;
+        case VALUE_WRAPPER_LONG: value->l = luaJniNewLong(env,(jlong) lua_tointeger(L,index)); return;
+        case VALUE_WRAPPER_FLOAT: value->l = luaJniNewFloat(env,(jfloat) lua_tonumber(L,index)); return;
+        case VALUE_WRAPPER_DOUBLE: value->l = luaJniNewDouble(env,(jdouble) lua_tonumber(L,index)); return;
+        case VALUE_ARRAY:
+            value->l = luaJniTakeObject(env,((JavaArray *) lua_touserdata(L,index))->id);
+            return;
+        case VALUE_CALLBACK:
+            if(lua_isfunction(L,index)){
+                value->l = type->newCallback(L,env,index);
+                return;
+            }
+            value->l = luaJniTakeObject(env,((JavaObject *) lua_touserdata(L,index))->id);
+            return;
+        default:
+            value->l = luaJniTakeObject(env,((JavaObject *) lua_touserdata(L,index))->id);
+            return;
+    }
+}
+
+//consume the local reference of value, return 0 if the error message has been pushed
+static int descriptorPushJava(lua_State *L, JNIEnv *env, const LuaJniTypeDescriptor *type, jvalue value){
+    switch (type->type) {
+        case VALUE_VOID: lua_pushnil(L); return 1;
+        case VALUE_BOOLEAN: lua_pushboolean(L,value.z); return 1;
+        case VALUE_BYTE: lua_pushinteger(L,value.b); return 1;
+        case VALUE_CHAR: lua_pushinteger(L,value.c); return 1;
+        case VALUE_SHORT: lua_pushinteger(L,value.s); return 1;
+        case VALUE_INT: lua_pushinteger(L,value.i); return 1;
+        case VALUE_LONG: lua_pushinteger(L,value.j); return 1;
+        case VALUE_FLOAT: lua_pushnumber(L,value.f); return 1;
+        case VALUE_DOUBLE: lua_pushnumber(L,value.d); return 1;
+        default: break;
+    }
+    if(value.l == NULL){
+        lua_pushnil(L);
+        return 1;
+    }
+    int r = 1;
+    switch (type->type) {
+        case VALUE_STRING: {
+            const char *str = (*env)->GetStringUTFChars(env,value.l,NULL);
+            lua_pushstring(L,str);
+            (*env)->ReleaseStringUTFChars(env,value.l,str);
+            break;
+        }
+        case VALUE_WRAPPER_BOOLEAN: lua_pushboolean(L,luaJniBooleanValue(env,value.l)); break;
+        case VALUE_WRAPPER_BYTE: lua_pushinteger(L,luaJniByteValue(env,value.l)); break;
+        case VALUE_WRAPPER_CHAR: lua_pushinteger(L,luaJniCharValue(env,value.l)); break;
+        case VALUE_WRAPPER_SHORT: lua_pushinteger(L,luaJniShortValue(env,value.l)); break;
+        case VALUE_WRAPPER_INT: lua_pushinteger(L,luaJniIntValue(env,value.l)); break;
+        case VALUE_WRAPPER_LONG: lua_pushinteger(L,luaJniLongValue(env,value.l)); break;
+        case VALUE_WRAPPER_FLOAT: lua_pushnumber(L,luaJniFloatValue(env,value.l)); break;
+        case VALUE_WRAPPER_DOUBLE: lua_pushnumber(L,luaJniDoubleValue(env,value.l)); break;
+        case VALUE_ARRAY: {
+            luaJniPushArray(L,env,value.l,type->level,type->className,type->elementType);
+            break;
+        }
+        default:
+            r = luaJniPushObject(L,env,value.l,type->className);
+            break;
+    }
+    (*env)->DeleteLocalRef(env,value.l);
+    return r;
+}
+
+#define DESCRIPTOR_CALL(staticStr,target) \
+    switch (member->type.type) {\
+        case VALUE_VOID: (*env)->Call##staticStr##VoidMethodA(env,target,method,args); break;\
+        case VALUE_BOOLEAN: result.z = (*env)->Call##staticStr##BooleanMethodA(env,target,method,args); break;\
+        case VALUE_BYTE: result.b = (*env)->Call##staticStr##ByteMethodA(env,target,method,args); break;\
+        case VALUE_CHAR: result.c = (*env)->Call##staticStr##CharMethodA(env,target,method,args); break;\
+        case VALUE_SHORT: result.s = (*env)->Call##staticStr##ShortMethodA(env,target,method,args); break;\
+        case VALUE_INT: result.i = (*env)->Call##staticStr##IntMethodA(env,target,method,args); break;\
+        case VALUE_LONG: result.j = (*env)->Call##staticStr##LongMethodA(env,target,method,args); break;\
+        case VALUE_FLOAT: result.f = (*env)->Call##staticStr##FloatMethodA(env,target,method,args); break;\
+        case VALUE_DOUBLE: result.d = (*env)->Call##staticStr##DoubleMethodA(env,target,method,args); break;\
+        default: result.l = (*env)->Call##staticStr##ObjectMethodA(env,target,method,args); break;\
+    }
+
+static jvalue descriptorCall(JNIEnv *env, jobject obj, const LuaJniMemberDescriptor *member, jmethodID method, const jvalue *args){
+    jvalue result;
+    result.j = 0;
+    if(member->isStatic){
+        DESCRIPTOR_CALL(Static,(jclass)obj)
+    }else{
+        DESCRIPTOR_CALL(,obj)
+    }
+    return result;
+}
+#undef DESCRIPTOR_CALL
+
+#define DESCRIPTOR_FIELD(staticStr) \
+    switch (member->type.type) {\
+        case VALUE_BOOLEAN: result.z = (*env)->Get##staticStr##BooleanField(env,obj,field); break;\
+        case VALUE_BYTE: result.b = (*env)->Get##staticStr##ByteField(env,obj,field); break;\
+        case VALUE_CHAR: result.c = (*env)->Get##staticStr##CharField(env,obj,field); break;\
+        case VALUE_SHORT: result.s = (*env)->Get##staticStr##ShortField(env,obj,field); break;\
+        case VALUE_INT: result.i = (*env)->Get##staticStr##IntField(env,obj,field); break;\
+        case VALUE_LONG: result.j = (*env)->Get##staticStr##LongField(env,obj,field); break;\
+        case VALUE_FLOAT: result.f = (*env)->Get##staticStr##FloatField(env,obj,field); break;\
+        case VALUE_DOUBLE: result.d = (*env)->Get##staticStr##DoubleField(env,obj,field); break;\
+        default: result.l = (*env)->Get##staticStr##ObjectField(env,obj,field); break;\
+    }
+
+static jvalue descriptorGetField(JNIEnv *env, jobject obj, const LuaJniMemberDescriptor *member, jfieldID field){
+    jvalue result;
+    result.j = 0;
+    if(member->isStatic){
+        DESCRIPTOR_FIELD(Static)
+    }else{
+        DESCRIPTOR_FIELD()
+    }
+    return result;
+}
+#undef DESCRIPTOR_FIELD
+
+#define DESCRIPTOR_SET_FIELD(staticStr) \
+    switch (member->type.type) {\
+        case VALUE_BOOLEAN: (*env)->Set##staticStr##BooleanField(env,obj,field,value.z); break;\
+        case VALUE_BYTE: (*env)->Set##staticStr##ByteField(env,obj,field,value.b); break;\
+        case VALUE_CHAR: (*env)->Set##staticStr##CharField(env,obj,field,value.c); break;\
+        case VALUE_SHORT: (*env)->Set##staticStr##ShortField(env,obj,field,value.s); break;\
+        case VALUE_INT: (*env)->Set##staticStr##IntField(env,obj,field,value.i); break;\
+        case VALUE_LONG: (*env)->Set##staticStr##LongField(env,obj,field,value.j); break;\
+        case VALUE_FLOAT: (*env)->Set##staticStr##FloatField(env,obj,field,value.f); break;\
+        case VALUE_DOUBLE: (*env)->Set##staticStr##DoubleField(env,obj,field,value.d); break;\
+        default: (*env)->Set##staticStr##ObjectField(env,obj,field,value.l); break;\
+    }
+
+static void descriptorSetField(JNIEnv *env, jobject obj, const LuaJniMemberDescriptor *member, jfieldID field, jvalue value){
+    if(member->isStatic){
+        DESCRIPTOR_SET_FIELD(Static)
+    }else{
+        DESCRIPTOR_SET_FIELD()
+    }
+}
+#undef DESCRIPTOR_SET_FIELD
+
+static void descriptorPushFrame(lua_State *L, JNIEnv *env, ClassRuntime *runtime, int index, int capacity){
+    if(runtime->stats){
+        luaJniPushStatsFrame(L,env,capacity,&runtime->stats[index]);
+    }else{
+        luaJniPushBindingFrame(L,env,capacity,runtime->descriptor->name,runtime->members[index]->name);
+    }
+}
+
+static int descriptorInvoke(lua_State *L, JNIEnv *env, ClassRuntime *runtime, int index, jobject obj, int origin){
+    const LuaJniMemberDescriptor *member = runtime->members[index];
+    jvalue args[LUA_JNI_MAX_ARGS];
+    descriptorPushFrame(L,env,runtime,index,member->argCount + LUA_JNI_LOCAL_FRAME_CAPACITY);
+    for(int i = 0; i < member->argCount; i++){
+        descriptorToJava(L,env,origin + i,&member->args[i],&args[i]);
+    }
+    jvalue result;
+    result.j = 0;
+    if(!(*env)->ExceptionCheck(env)){
+        if(member->kind == MEMBER_CONSTRUCTOR){
+            result.l = (*env)->NewObjectA(env,(jclass)obj,(jmethodID)runtime->ids[index],args);
+        }else{
+            result = descriptorCall(env,obj,member,(jmethodID)runtime->ids[index],args);
+        }
+    }
+    if(luaJniCatchJavaException(L,env)){
+        luaJniPopLocalFrame(L,env);
+        lua_error(L);
+    }
+    LuaJniTypeDescriptor constructorType = {VALUE_OBJECT,runtime->descriptor->name,0,ELEMENT_OBJECT,NULL};
+    const LuaJniTypeDescriptor *type = member->kind == MEMBER_CONSTRUCTOR ? &constructorType : &member->type;
+    int pushed = descriptorPushJava(L,env,type,result);
+    luaJniPopLocalFrame(L,env);
+    if(!pushed){
+        lua_error(L);
+    }
+    if(member->kind == MEMBER_CONSTRUCTOR){
+        return 1;
+    }
+    //a null result unpacks to nils, as the generated bindings do
+    if(member->unpackCount > 0 && lua_isnil(L,-1)){
+        lua_pop(L,1);
+        for(int i = 0; i < member->unpackCount; i++){
+            lua_pushnil(L);
+        }
+        return member->unpackCount;
+    }
+    for(int i = 0; i < member->unpackCount; i++){
+        lua_getfield(L,-1-i,member->unpack[i]);
+    }
+    return member->unpackCount > 0 ? member->unpackCount : 1;
+}
+
+static int descriptorMethodCall(lua_State *L){
+    ClassRuntime *runtime = (ClassRuntime *) lua_touserdata(L,lua_upvalueindex(1));
+    int start = (int) lua_tointeger(L,lua_upvalueindex(2));
+    int count = (int) lua_tointeger(L,lua_upvalueindex(3));
+    JNIEnv *env = luaJniGetEnv(L);
+    for(int i = start; i < start + count; i++){
+        const LuaJniMemberDescriptor *member = runtime->members[i];
+        if(member->kind == MEMBER_CONSTRUCTOR || member->isStatic){
+            if(descriptorMatchArgs(L,member,1)){
+                return descriptorInvoke(L,env,runtime,i,luaJniTakeObject(env,runtime->id),1);
+            }
+        }else if(descriptorMatchArgs(L,member,2)){
+            JavaObject *object = (JavaObject *) luaL_checkudata(L,1,runtime->descriptor->name);
+            return descriptorInvoke(L,env,runtime,i,luaJniTakeObject(env,object->id),2);
+        }
+    }
+    return luaL_error(L,"method %s parameter mismatch",runtime->members[start]->name);
+}
+
+static void descriptorPushMethod(lua_State *L, ClassRuntime *runtime, int start, int count){
+    lua_pushlightuserdata(L,runtime);
+    lua_pushinteger(L,start);
+    lua_pushinteger(L,count);
+    lua_pushcclosure(L,descriptorMethodCall,3);
+}
+
+static int descriptorIndex(lua_State *L){
+    ClassRuntime *runtime = (ClassRuntime *) lua_touserdata(L,lua_upvalueindex(1));
+    JavaObject *object = (JavaObject *) luaL_checkudata(L,1,runtime->descriptor->name);
+    const char *key = luaL_checkstring(L,2);
+    JNIEnv *env = luaJniGetEnv(L);
+    int count = 0;
+    int start = descriptorFind(runtime,key,MEMBER_FIELD,&count);
+    if(count > 0){
+        const LuaJniMemberDescriptor *member = runtime->members[start];
+        if(member->cached && luaJniPushCachedField(L,1,member->name)){
+            return 1;
+        }
+        jobject obj = luaJniTakeObject(env,(member->isStatic ? runtime->id : object->id));
+        //object and string reads make local refs, the frame keeps them bounded in long loops
+        descriptorPushFrame(L,env,runtime,start,LUA_JNI_LOCAL_FRAME_CAPACITY);
+        jvalue value = descriptorGetField(env,obj,member,(jfieldID)runtime->ids[start]);
+        int pushed = !luaJniCatchJavaException(L,env) && descriptorPushJava(L,env,&member->type,value);
+        luaJniPopLocalFrame(L,env);
+        if(!pushed){
+            lua_error(L);
+        }
+        if(member->cached){
+            luaJniCacheField(L,1,member->name);
+        }
+        return 1;
+    }
+    start = descriptorFind(runtime,key,MEMBER_GETTER,&count);
+    if(count > 0){
+        const LuaJniMemberDescriptor *member = runtime->members[start];
+        if(member->cached && luaJniPushCachedField(L,1,member->name)){
+            return 1;
+        }
+        jobject obj = luaJniTakeObject(env,(member->isStatic ? runtime->id : object->id));
+        lua_settop(L,1);
+        int r = descriptorInvoke(L,env,runtime,start,obj,2);
+        if(member->cached && member->unpackCount == 0){
+            luaJniCacheField(L,1,member->name);
+        }
+        return r;
+    }
+    start = descriptorFind(runtime,key,MEMBER_METHOD,&count);
+    if(count > 0){
+        descriptorPushMethod(L,runtime,start,count);
+        return 1;
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int descriptorNewIndex(lua_State *L){
+    ClassRuntime *runtime = (ClassRuntime *) lua_touserdata(L,lua_upvalueindex(1));
+    JavaObject *object = (JavaObject *) luaL_checkudata(L,1,runtime->descriptor->name);
+    const char *key = luaL_checkstring(L,2);
+    JNIEnv *env = luaJniGetEnv(L);
+    int count = 0;
+    int start = descriptorFind(runtime,key,MEMBER_FIELD,&count);
+    if(count > 0 && !runtime->members[start]->readonly){
+        const LuaJniMemberDescriptor *member = runtime->members[start];
+        if(!descriptorMatch(L,3,&member->type)){
+            return luaL_error(L,"Parameter 3 must be a %s",member->type.className ? member->type.className : luaL_typename(L,3));
+        }
+        jvalue value;
+        descriptorPushFrame(L,env,runtime,start,LUA_JNI_LOCAL_FRAME_CAPACITY);
+        descriptorToJava(L,env,3,&member->type,&value);
+        jobject obj = luaJniTakeObject(env,(member->isStatic ? runtime->id : object->id));
+        if(!(*env)->ExceptionCheck(env)){
+            descriptorSetField(env,obj,member,(jfieldID)runtime->ids[start],value);
+        }
+        if(luaJniCatchJavaException(L,env)){
+            luaJniPopLocalFrame(L,env);
+            lua_error(L);
+        }
+        luaJniPopLocalFrame(L,env);
+        return 0;
+    }
+    start = descriptorFind(runtime,key,MEMBER_SETTER,&count);
+    for(int i = start; i < start + count; i++){
+        const LuaJniMemberDescriptor *member = runtime->members[i];
+        if(descriptorMatch(L,3,&member->args[0])){
+            jobject obj = luaJniTakeObject(env,(member->isStatic ? runtime->id : object->id));
+            descriptorInvoke(L,env,runtime,i,obj,3);
+            return 0;
+        }
+    }
+    return luaL_error(L,"Can't find member %s",key);
+}
+
+static int descriptorInject(lua_State *L, JNIEnv *env, void *userData){
+    ClassRuntime *runtime = (ClassRuntime *) userData;
+    const LuaJniClassDescriptor *descriptor = runtime->descriptor;
+    if(luaL_newmetatable(L,descriptor->name)){
+        luaL_Reg meta[] = {
+            {"__index",    descriptorIndex},
+            {"__newindex", descriptorNewIndex},
+            {"__gc",       luaJniJavaObjectGc},
+            {NULL,NULL}
+        };
+        lua_pushlightuserdata(L,runtime);
+        luaL_setfuncs(L,meta,1);
+    }
+    lua_pop(L,1);
+    if(descriptor->autoRegister){
+        jobject obj = (*env)->NewObject(env,(jclass)luaJniTakeObject(env,runtime->id),runtime->defaultConstructor);
+        luaJniCatchJavaAndThrowLuaException(L,env);
+        if(!luaJniPushObject(L,env,obj,descriptor->name)){
+            (*env)->DeleteLocalRef(env,obj);
+            lua_error(L);
+        }
+        (*env)->DeleteLocalRef(env,obj);
+        lua_setglobal(L,descriptor->globalName);
+    }else if(runtime->constructorCount > 0){
+        descriptorPushMethod(L,runtime,runtime->constructorStart,runtime->constructorCount);
+        lua_setglobal(L,descriptor->globalName);
+    }
+    for(int i = 0; i < descriptor->memberCount;){
+        const LuaJniMemberDescriptor *member = runtime->members[i];
+        int count = 1;
+        if(member->kind == MEMBER_FUNCTION){
+            descriptorFind(runtime,member->name,MEMBER_FUNCTION,&count);
+            descriptorPushMethod(L,runtime,i,count);
+            lua_setglobal(L,member->name);
+        }
+        i += count;
+    }
+    return 0;
+}
+
+//stats stay reachable from luaJniBindingStatsList, so they are never freed and a registered again descriptor reuses them
+typedef struct DescriptorStats{
+    const LuaJniClassDescriptor *descriptor;
+    LuaJniBindingStats *stats;
+    struct DescriptorStats *next;
+}DescriptorStats;
+
+static DescriptorStats *descriptorStats = NULL;
+static pthread_mutex_t descriptorStatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static LuaJniBindingStats *descriptorStatsFor(ClassRuntime *runtime){
+    const LuaJniClassDescriptor *descriptor = runtime->descriptor;
+    int count = descriptor->memberCount;
+    pthread_mutex_lock(&descriptorStatsLock);
+    DescriptorStats *entry = descriptorStats;
+    while(entry && entry->descriptor != descriptor){
+        entry = entry->next;
+    }
+    if(entry == NULL){
+        entry = (DescriptorStats *) malloc(sizeof(DescriptorStats));
+        entry->descriptor = descriptor;
+        entry->stats = (LuaJniBindingStats *) calloc(count + 1,sizeof(LuaJniBindingStats));
+        for(int i = 0; i < count; i++){
+            entry->stats[i].className = descriptor->name;
+            entry->stats[i].member = runtime->members[i]->name;
+        }
+        entry->next = descriptorStats;
+        descriptorStats = entry;
+    }
+    pthread_mutex_unlock(&descriptorStatsLock);
+    return entry->stats;
+}
+
+int luaJniRegisterFailed(JNIEnv *env, const char *name, const char *member) {
+    if(LUA_JNI_LOG_ENABLED(LUA_JNI_LOG_WARN)){
+        (*env)->ExceptionDescribe(env);
+    }
+    (*env)->ExceptionClear(env);
+    LOGE("can not register %s, %s not found \n",name,member);
+    return 0;
+}
+
+static int descriptorFail(JNIEnv *env, ClassRuntime *runtime, jclass clazz, const char *member){
+    luaJniRegisterFailed(env,runtime->descriptor->name,member);
+    if(clazz){
+        (*env)->DeleteLocalRef(env,clazz);
+    }
+    free(runtime->members);
+    free(runtime->ids);
+    free(runtime);
+    return 0;
+}
+
+int luaJniRegisterClassDescriptor(JNIEnv *env, const LuaJniClassDescriptor *descriptor) {
+    int count = descriptor->memberCount;
+    ClassRuntime *runtime = (ClassRuntime *) malloc(sizeof(ClassRuntime));
+    runtime->descriptor = descriptor;
+    runtime->members = (const LuaJniMemberDescriptor **) malloc(sizeof(LuaJniMemberDescriptor *) * (count + 1));
+    runtime->ids = (void **) malloc(sizeof(void *) * (count + 1));
+    for(int i = 0; i < count; i++){
+        runtime->members[i] = &descriptor->members[i];
+    }
+    qsort(runtime->members,count,sizeof(LuaJniMemberDescriptor *),compareMember);
+    jclass clazz = (*env)->FindClass(env,descriptor->classPath);
+    if(clazz == NULL){
+        return descriptorFail(env,runtime,NULL,descriptor->classPath);
+    }
+    for(int i = 0; i < count; i++){
+        const LuaJniMemberDescriptor *member = runtime->members[i];
+        if(member->kind == MEMBER_FIELD){
+            runtime->ids[i] = member->isStatic ?
+                    (void *) (*env)->GetStaticFieldID(env,clazz,member->javaName,member->signature) :
+                    (void *) (*env)->GetFieldID(env,clazz,member->javaName,member->signature);
+        }else if(member->isStatic){
+            runtime->ids[i] = (void *) (*env)->GetStaticMethodID(env,clazz,member->javaName,member->signature);
+        }else{
+            runtime->ids[i] = (void *) (*env)->GetMethodID(env,clazz,member->javaName,member->signature);
+        }
+        if((*env)->ExceptionCheck(env)){
+            return descriptorFail(env,runtime,clazz,member->javaName);
+        }
+    }
+    runtime->defaultConstructor = NULL;
+    if(descriptor->autoRegister){
+        runtime->defaultConstructor = (*env)->GetMethodID(env,clazz,"<init>","()V");
+        if((*env)->ExceptionCheck(env)){
+            return descriptorFail(env,runtime,clazz,"<init>");
+        }
+    }
+    runtime->stats = descriptor->stats ? descriptorStatsFor(runtime) : NULL;
+    runtime->constructorStart = descriptorFind(runtime,"<init>",MEMBER_CONSTRUCTOR,&runtime->constructorCount);
+    runtime->id = luaJniCacheObject(env,clazz);
+    (*env)->DeleteLocalRef(env,clazz);
+    luaJniRegister(descriptor->name,descriptorInject,runtime);
+    return 1;
+}
+
+int luaJniUnregisterClassDescriptor(JNIEnv *env, const LuaJniClassDescriptor *descriptor) {
+    ClassRuntime *runtime = (ClassRuntime *) luaJniUnregister(descriptor->name);
+    if(runtime){
+        luaJniReleaseObject(env,runtime->id);
+        free(runtime->members);
+        free(runtime->ids);
+        free(runtime);
+    }
+    return 1;
+}
+
+
 unsigned int hashMapHash(const char *key) {
     unsigned int hash = 0;
     while (*key) {
@@ -678,7 +2999,7 @@ HashMap *ensureHashMap() {
 
 int luaJniRegister(const char *name, LuaJniInjectMethod method, void *userData) {
     HashMap *map = ensureHashMap();
-    LOGD("register %s",name);
+    LOGD("register %s\n",name);
     hashMapPut(map, name, method, userData);
     return 1;
 }
@@ -689,8 +3010,7 @@ void* luaJniUnregister(const char *name) {
 }
 
 JNIEnv* luaJniGetEnv(lua_State *L) {
-    JNIEnv **envPtr = (JNIEnv **) lua_getextraspace(L);
-    return *envPtr;
+    return getState(L)->env;
 }
 
 
@@ -742,6 +3062,40 @@ int luaJniInitContext(JNIEnv *env) {
     ctx->newDouble = (*env)->GetMethodID(env,clazz,"<init>", "(D)V");
     ctx->doubleValue = (*env)->GetMethodID(env,clazz,"doubleValue", "()D");
     (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/lang/Throwable");
+    ctx->throwableClass = (*env)->NewWeakGlobalRef(env,clazz);
+    ctx->getMessage = (*env)->GetMethodID(env,clazz,"getMessage", "()Ljava/lang/String;");
+    ctx->getStackTrace = (*env)->GetMethodID(env,clazz,"getStackTrace", "()[Ljava/lang/StackTraceElement;");
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/lang/Object");
+    ctx->toString = (*env)->GetMethodID(env,clazz,"toString", "()Ljava/lang/String;");
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/lang/String");
+    ctx->stringClass = (*env)->NewWeakGlobalRef(env,clazz);
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/lang/Class");
+    ctx->getName = (*env)->GetMethodID(env,clazz,"getName", "()Ljava/lang/String;");
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/util/Collection");
+    ctx->collectionClass = (*env)->NewWeakGlobalRef(env,clazz);
+    ctx->size = (*env)->GetMethodID(env,clazz,"size", "()I");
+    ctx->toArray = (*env)->GetMethodID(env,clazz,"toArray", "()[Ljava/lang/Object;");
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/util/List");
+    ctx->listClass = (*env)->NewWeakGlobalRef(env,clazz);
+    ctx->subList = (*env)->GetMethodID(env,clazz,"subList", "(II)Ljava/util/List;");
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/util/RandomAccess");
+    ctx->randomAccessClass = (*env)->NewWeakGlobalRef(env,clazz);
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/lang/Iterable");
+    ctx->iterableClass = (*env)->NewWeakGlobalRef(env,clazz);
+    ctx->iterator = (*env)->GetMethodID(env,clazz,"iterator", "()Ljava/util/Iterator;");
+    (*env)->DeleteLocalRef(env,clazz);
+    clazz = (*env)->FindClass(env,"java/util/Iterator");
+    ctx->hasNext = (*env)->GetMethodID(env,clazz,"hasNext", "()Z");
+    ctx->next = (*env)->GetMethodID(env,clazz,"next", "()Ljava/lang/Object;");
+    (*env)->DeleteLocalRef(env,clazz);
     context = ctx;
     return 1;
 }
@@ -757,6 +3111,12 @@ int luaJniReleaseContext(JNIEnv *env) {
         (*env)->DeleteWeakGlobalRef(env,context->longClass);
         (*env)->DeleteWeakGlobalRef(env,context->floatClass);
         (*env)->DeleteWeakGlobalRef(env,context->doubleClass);
+        (*env)->DeleteWeakGlobalRef(env,context->throwableClass);
+        (*env)->DeleteWeakGlobalRef(env,context->stringClass);
+        (*env)->DeleteWeakGlobalRef(env,context->collectionClass);
+        (*env)->DeleteWeakGlobalRef(env,context->listClass);
+        (*env)->DeleteWeakGlobalRef(env,context->randomAccessClass);
+        (*env)->DeleteWeakGlobalRef(env,context->iterableClass);
         free(context);
         context = NULL;
     }
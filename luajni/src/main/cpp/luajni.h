@@ -36,6 +36,79 @@ typedef struct {
     int64_t id;
 }JavaObject;
 
+typedef struct LuaJniCallback LuaJniCallback;
+
+#define LUA_JNI_MAX_ARGS 32
+
+enum LUA_JNI_VALUE_TYPE{
+    VALUE_VOID,
+    VALUE_BOOLEAN,
+    VALUE_BYTE,
+    VALUE_CHAR,
+    VALUE_SHORT,
+    VALUE_INT,
+    VALUE_LONG,
+    VALUE_FLOAT,
+    VALUE_DOUBLE,
+    VALUE_STRING,
+    VALUE_WRAPPER_BOOLEAN,
+    VALUE_WRAPPER_BYTE,
+    VALUE_WRAPPER_CHAR,
+    VALUE_WRAPPER_SHORT,
+    VALUE_WRAPPER_INT,
+    VALUE_WRAPPER_LONG,
+    VALUE_WRAPPER_FLOAT,
+    VALUE_WRAPPER_DOUBLE,
+    VALUE_OBJECT,
+    VALUE_ARRAY,
+    VALUE_CALLBACK
+};
+
+enum LUA_JNI_MEMBER_KIND{
+    MEMBER_FIELD,
+    MEMBER_GETTER,
+    MEMBER_SETTER,
+    MEMBER_METHOD,
+    MEMBER_CONSTRUCTOR,
+    MEMBER_FUNCTION
+};
+
+typedef jobject(*LuaJniNewCallbackMethod)(lua_State*L, JNIEnv*env, int index);
+
+typedef struct {
+    enum LUA_JNI_VALUE_TYPE type;
+    const char *className;
+    int level;
+    enum ARRAY_ELEMENT_TYPE elementType;
+    LuaJniNewCallbackMethod newCallback;
+} LuaJniTypeDescriptor;
+
+typedef struct {
+    const char *name;
+    const char *javaName;
+    const char *signature;
+    enum LUA_JNI_MEMBER_KIND kind;
+    int isStatic;
+    int readonly;
+    int cached;
+    LuaJniTypeDescriptor type;
+    int argCount;
+    const LuaJniTypeDescriptor *args;
+    int unpackCount;
+    const char *const *unpack;
+} LuaJniMemberDescriptor;
+
+typedef struct {
+    const char *name;
+    const char *classPath;
+    const char *globalName;
+    int autoRegister;
+    int memberCount;
+    const LuaJniMemberDescriptor *members;
+    //record LuaJniBindingStats for every member
+    int stats;
+} LuaJniClassDescriptor;
+
 
 typedef int(*LuaJniInjectMethod)(lua_State*L, JNIEnv *env,void*userData);
 
@@ -43,24 +116,150 @@ int luaJniInitContext(JNIEnv*env);
 int luaJniReleaseContext(JNIEnv*env);
 int luaJniRegister(const char*name, LuaJniInjectMethod method, void* userData);
 void* luaJniUnregister(const char*name);
+//clear and log the pending exception of a failed registration of name, return 0
+int luaJniRegisterFailed(JNIEnv*env, const char*name, const char*member);
 JNIEnv* luaJniGetEnv(lua_State*L);
+void luaJniSetEnv(lua_State*L, JNIEnv*env);
 void luaJniInitLua(lua_State*L, JNIEnv *env);
+void luaJniCloseLua(lua_State*L);
 int luaJniInject(lua_State*L, JNIEnv *env,const char*name);
 int luaJniInjectAll(lua_State*L, JNIEnv *env);
 int luaJniRegisteredCount();
+int luaJniRegisterClassDescriptor(JNIEnv*env, const LuaJniClassDescriptor*descriptor);
+int luaJniUnregisterClassDescriptor(JNIEnv*env, const LuaJniClassDescriptor*descriptor);
 
 
 int64_t luaJniCacheObject(JNIEnv*env, jobject obj);
 void luaJniReleaseObject(JNIEnv*env, int64_t id);
 #define luaJniTakeObject(env,id) ((jobject)id)
 #define luaJniPutBackObject(env,obj)
+//return 1 is success, 0 is the metatable of className not found
+int luaJniPushObject(lua_State*L, JNIEnv*env, jobject obj, const char*className);
+//push a non null object, the userdata holds no reference and has no metatable if className is not registered
+void luaJniNewObject(lua_State*L, JNIEnv*env, jobject obj, const char*className);
+
+#define LUA_JNI_GC_HANDLE_BYTES 512
+#define LUA_JNI_GC_STEP_BYTES (256 * 1024)
+//the global reference table of android holds 51200 entries
+#define LUA_JNI_GC_GLOBAL_REF_LIMIT 40000
+//every new handle costs handleBytes plus the size estimate of its class, a gc step runs once stepBytes are owed
+//and a full collection instead when more than globalRefLimit handles of L are alive, stepBytes <= 0 disables it.
+//a full collection which leaves more than globalRefLimit alive is not repeated until a quarter of the limit more are
+//alive, steps run meanwhile
+void luaJniSetGcPolicy(lua_State*L, int64_t handleBytes, int64_t stepBytes, int64_t globalRefLimit, int generational);
+//return 0 if className is not registered in L
+int luaJniSetSizeEstimate(lua_State*L, const char*className, int64_t bytes);
+
+LuaJniCallback* luaJniNewCallback(lua_State*L, int index);
+//return a new local ref of the live proxy created for the function at index with the same key, or NULL
+jobject luaJniFindCallback(lua_State*L, JNIEnv*env, int index, const char*key);
+//remember proxy as the one of the function at index, key must be a static string naming the proxy class
+void luaJniCacheCallback(lua_State*L, JNIEnv*env, int index, const char*key, LuaJniCallback*callback, jobject proxy);
+//return NULL and throw IllegalStateException if the interpreter of callback has been destroyed or the calling
+//thread does not own it, the owner is the thread which created the interpreter or last called luaJniSetEnv
+lua_State* luaJniCallbackEnter(JNIEnv*env, LuaJniCallback*callback, JNIEnv**savedEnv);
+//return 1 is success, 0 is lua error and it has been thrown as java LuaError
+int luaJniCallbackCall(lua_State*L, JNIEnv*env, int nargs, int nresults);
+void luaJniCallbackLeave(lua_State*L, JNIEnv*savedEnv, int top);
+void luaJniReleaseCallback(LuaJniCallback*callback);
+void luaJniThrowLuaError(JNIEnv*env, const char*message);
+//throw the lua error value at index, a lazy java throwable becomes the cause of the LuaError
+void luaJniThrowLuaErrorAt(lua_State*L, JNIEnv*env, int index);
+
+#define LUA_JNI_LOCAL_FRAME_CAPACITY 16
+//every generated call runs in its own local frame, frames skipped by lua_error are popped at the next protected boundary
+int luaJniPushLocalFrame(lua_State*L, JNIEnv*env, int capacity);
+void luaJniPopLocalFrame(lua_State*L, JNIEnv*env);
+//pop and push the current frame, used by bulk conversions to keep the local reference table bounded
+int luaJniFlushLocalFrame(lua_State*L, JNIEnv*env, int capacity);
+int luaJniLocalFrameDepth(lua_State*L);
+void luaJniPopLocalFrames(lua_State*L, JNIEnv*env, int depth);
+//the frame of a bound java member, it is attributed to className.member while the profiler is running
+int luaJniPushBindingFrame(lua_State*L, JNIEnv*env, int capacity, const char*className, const char*member);
+
+#define LUA_JNI_STATS_BUCKETS 32
+//call count and latency histogram of one bound member, bucket i counts calls taking [2^i,2^(i+1)) nanoseconds
+typedef struct LuaJniBindingStats{
+    const char *className;
+    const char *member;
+    uint64_t calls;
+    uint64_t histogram[LUA_JNI_STATS_BUCKETS];
+    int registered;
+    struct LuaJniBindingStats *next;
+}LuaJniBindingStats;
+
+//the frame of a member generated with the luajni.stats option, the stats are listed by luaJniBindingStatsList after the first call
+int luaJniPushStatsFrame(lua_State*L, JNIEnv*env, int capacity, LuaJniBindingStats*stats);
+//stats are sorted by member, the last one is returned for unknown names
+LuaJniBindingStats* luaJniFindBindingStats(LuaJniBindingStats*stats, int count, const char*member);
+LuaJniBindingStats* luaJniBindingStatsList(void);
+
+typedef struct LuaJniGauges{
+    int64_t globalRefs;
+    int64_t handlesCreated;
+    int64_t handlesCollected;
+    int64_t luaHeapBytes;
+    int64_t callbacks;
+    int64_t frameDepth;
+}LuaJniGauges;
+void luaJniGetGauges(lua_State*L, LuaJniGauges*gauges);
+
+//sample lua stacks every instructionInterval instructions and time one of every bindingInterval binding calls
+void luaJniStartProfiler(lua_State*L, int instructionInterval, int bindingInterval);
+//push the samples as collapsed stacks with nanosecond weights and stop the profiler
+void luaJniStopProfiler(lua_State*L);
+
+//reasons of a LuaAbortError, 0 if the call has not been aborted
+#define LUA_JNI_ABORT_INSTRUCTIONS 1
+#define LUA_JNI_ABORT_DEADLINE 2
+#define LUA_JNI_ABORT_CANCELLED 3
+//instructions between two checks of the deadline and the cancel flag
+#define LUA_JNI_BUDGET_CHECK_INTERVAL 1000
+//budget of every call which enters the interpreter from a callback, <= 0 for unlimited
+void luaJniSetCallBudget(lua_State*L, int64_t instructions, int64_t timeoutMillis);
+//the outermost call owns the budget and returns 1, nested calls share it and return 0
+int luaJniBeginCall(lua_State*L, int64_t instructions, int64_t timeoutMillis);
+//must be called after the error of the call has been thrown, owner is the result of luaJniBeginCall
+void luaJniEndCall(lua_State*L, int owner);
+//abort the running call from any thread but not concurrently with luaJniCloseLua, only a flag is set: the hook
+//of a budgeted call sees it within LUA_JNI_BUDGET_CHECK_INTERVAL instructions, an unbudgeted call at its next
+//binding call. The interpreter stays usable, a cancel without a running call is dropped by luaJniBeginCall
+void luaJniCancel(lua_State*L);
+//run worker under the deadline, the remaining instructions and the cancel flag of the running call of L,
+//the instructions are one pool for all workers and what they use is charged to L. worker must be idle and
+//is only touched by the thread which runs it until luaJniUnshareBudget, L must not run until then
+void luaJniShareBudget(lua_State*L, lua_State*worker);
+//end the shared call of worker, return its abort reason
+int luaJniUnshareBudget(lua_State*worker);
+//abort the running call of L with reason, or when it has been cancelled or its deadline has passed
+void luaJniCheckBudget(lua_State*L, int reason);
+
+
+//push java exceptions as JavaThrowable userdata instead of their message, tostring(e), e.message and e.stackTrace
+//copy the strings on demand, 0 by default
+void luaJniSetLazyExceptions(lua_State*L, int lazy);
 
+#define LUA_JNI_PARALLEL_MAX_WORKERS 64
+//luajni.parallel(source, items [, {workers = n}]), source is a chunk returning fn, fn(item, index) runs on
+//worker interpreters with every registered class and the results are returned in the order of items,
+//only nil, boolean, number, string and table values are copied between the interpreters
+int luaJniParallel(lua_State*L);
 
+//levels of mlog.h, messages below the level are skipped, LUA_JNI_LOG_MIN_LEVEL bounds what can be enabled
+void luaJniSetLogLevel(int level);
 
 int luaJniJavaObjectGc(lua_State *L);
+//the values of readonly members are cached in the user value of the object
+//return 1 and push the cached value, 0 if it has not been cached
+int luaJniPushCachedField(lua_State*L, int index, const char*name);
+//cache the value on the top of the stack and keep it on the stack
+void luaJniCacheField(lua_State*L, int index, const char*name);
 int luaJniCatchJavaException(lua_State*L, JNIEnv*env);
 void luaJniCatchJavaAndThrowLuaException(lua_State*L, JNIEnv*env);
 
+//push a non null array
+void luaJniPushArray(lua_State*L, JNIEnv*env, jobject array, int level, const char*name,
+                     enum ARRAY_ELEMENT_TYPE elementType);
 int luaJniEqualJavaArray(JavaArray* a, const char*className, int level, enum ARRAY_ELEMENT_TYPE elementType);
 
 //return 1 is success, 0 is java exception
@@ -85,6 +284,23 @@ LUA_PUSH_FIELD_X(String);
 
 int luaJniPushObjectField(lua_State*L, JNIEnv *env, jobject obj,jfieldID field,const char*className);
 int luaJniPushStaticObjectField(lua_State*L, JNIEnv *env, jobject obj,jfieldID field,const char*className);
+//a java enum is exported to lua as the names of its constants, values caches the global refs of values() by ordinal
+typedef struct LuaJniEnum{
+    const char *className;
+    int count;
+    const char *const *names;
+    jobject *values;
+    jmethodID ordinal;
+}LuaJniEnum;
+//return 0 if the constants can not be read
+int luaJniInitEnum(JNIEnv*env, LuaJniEnum*e, jclass clazz);
+void luaJniReleaseEnum(JNIEnv*env, LuaJniEnum*e);
+//push the constant name, nil for null, return 0 with the error message pushed
+int luaJniPushEnum(lua_State*L, JNIEnv*env, const LuaJniEnum*e, jobject value);
+//return the ordinal of the constant name at index or -1
+int luaJniEnumIndex(lua_State*L, int index, const LuaJniEnum*e);
+int luaJniPushEnumField(lua_State*L, JNIEnv *env, jobject obj,jfieldID field,const LuaJniEnum*e);
+int luaJniPushStaticEnumField(lua_State*L, JNIEnv *env, jobject obj,jfieldID field,const LuaJniEnum*e);
 int luaJniPushArrayField(lua_State*L, JNIEnv *env, jobject obj,jfieldID field,const char*className,int level,
                     enum ARRAY_ELEMENT_TYPE elementType);
 int luaJniPushStaticArrayField(lua_State*L, JNIEnv *env, jobject obj,jfieldID field,const char*className,int level,
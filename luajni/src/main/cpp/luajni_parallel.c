@@ -0,0 +1,519 @@
+//
+// luajni.parallel, maps a lua function over a table on worker interpreters
+//
+#include "luajni.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include "mlog.h"
+
+#define PARALLEL_POOL_META_NAME "LuaJniParallelPool"
+#define PARALLEL_JOB_META_NAME "LuaJniParallelJob"
+#define PARALLEL_FUNCTIONS_KEY "luajni.parallel.functions"
+#define PARALLEL_MAX_DEPTH 32
+
+#ifdef __ANDROID__
+#define ATTACH_THREAD(vm,env) (*(vm))->AttachCurrentThread(vm,env,NULL)
+#else
+#define ATTACH_THREAD(vm,env) (*(vm))->AttachCurrentThread(vm,(void**)(env),NULL)
+#endif
+
+//values cross the states as a tag byte followed by the payload, tables as key value pairs ended by PARALLEL_END
+enum{
+    PARALLEL_NIL,
+    PARALLEL_FALSE,
+    PARALLEL_TRUE,
+    PARALLEL_INTEGER,
+    PARALLEL_NUMBER,
+    PARALLEL_STRING,
+    PARALLEL_TABLE,
+    PARALLEL_END
+};
+
+typedef struct Buffer{
+    char *data;
+    size_t size;
+    size_t capacity;
+}Buffer;
+
+typedef struct Result{
+    char *data;
+    size_t size;
+}Result;
+
+//begin in the high half and end in the low half, so that the owner and the thieves agree with one compare and swap
+typedef struct WorkRange{
+    uint64_t value;
+    char padding[64 - sizeof(uint64_t)];
+}WorkRange;
+
+//the worker states live as long as the interpreter and keep the loaded functions between calls
+typedef struct Pool{
+    int count;
+    lua_State *states[LUA_JNI_PARALLEL_MAX_WORKERS];
+}Pool;
+
+typedef struct Job{
+    JavaVM *vm;
+    const char *source;
+    size_t sourceLength;
+    Pool *pool;
+    int workerCount;
+    int count;
+    Buffer input;
+    size_t *offsets;
+    Result *results;
+    WorkRange *ranges;
+    int failed;
+    char error[256];
+}Job;
+
+typedef struct Worker{
+    Job *job;
+    int id;
+}Worker;
+
+static const char *bufferReserve(Buffer *buffer, size_t size){
+    if(buffer->size + size <= buffer->capacity){
+        return NULL;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+    while(capacity < buffer->size + size){
+        capacity *= 2;
+    }
+    char *data = (char *) realloc(buffer->data,capacity);
+    if(data == NULL){
+        return "not enough memory";
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return NULL;
+}
+
+static const char *bufferWrite(Buffer *buffer, const void *data, size_t size){
+    const char *error = bufferReserve(buffer,size);
+    if(error == NULL){
+        memcpy(buffer->data + buffer->size,data,size);
+        buffer->size += size;
+    }
+    return error;
+}
+
+static const char *bufferTag(Buffer *buffer, char tag){
+    return bufferWrite(buffer,&tag,1);
+}
+
+//return NULL or a static error message, the buffer is left to the caller either way
+static const char *encodeValue(lua_State *L, int index, Buffer *buffer, int depth){
+    switch(lua_type(L,index)){
+        case LUA_TNIL:
+            return bufferTag(buffer,PARALLEL_NIL);
+        case LUA_TBOOLEAN:
+            return bufferTag(buffer,lua_toboolean(L,index) ? PARALLEL_TRUE : PARALLEL_FALSE);
+        case LUA_TNUMBER:{
+            const char *error;
+            if(lua_isinteger(L,index)){
+                lua_Integer value = lua_tointeger(L,index);
+                if((error = bufferTag(buffer,PARALLEL_INTEGER)) == NULL){
+                    error = bufferWrite(buffer,&value,sizeof(value));
+                }
+            }else{
+                lua_Number value = lua_tonumber(L,index);
+                if((error = bufferTag(buffer,PARALLEL_NUMBER)) == NULL){
+                    error = bufferWrite(buffer,&value,sizeof(value));
+                }
+            }
+            return error;
+        }
+        case LUA_TSTRING:{
+            size_t length;
+            const char *str = lua_tolstring(L,index,&length);
+            const char *error = bufferTag(buffer,PARALLEL_STRING);
+            if(error == NULL) error = bufferWrite(buffer,&length,sizeof(length));
+            if(error == NULL) error = bufferWrite(buffer,str,length);
+            return error;
+        }
+        case LUA_TTABLE:{
+            if(depth >= PARALLEL_MAX_DEPTH){
+                return "table is nested too deep or recursive";
+            }
+            if(!lua_checkstack(L,3)){
+                return "stack overflow";
+            }
+            index = lua_absindex(L,index);
+            const char *error = bufferTag(buffer,PARALLEL_TABLE);
+            lua_pushnil(L);
+            while(error == NULL && lua_next(L,index)){
+                error = encodeValue(L,-2,buffer,depth + 1);
+                if(error == NULL) error = encodeValue(L,-1,buffer,depth + 1);
+                lua_pop(L,1);
+            }
+            if(error != NULL){
+                lua_pop(L,1);
+                return error;
+            }
+            return bufferTag(buffer,PARALLEL_END);
+        }
+        default:
+            return "only nil, boolean, number, string and table can be passed between interpreters";
+    }
+}
+
+static void decodeValue(lua_State *L, const char **cursor){
+    const char *p = *cursor;
+    char tag = *p++;
+    switch(tag){
+        case PARALLEL_NIL:
+            lua_pushnil(L);
+            break;
+        case PARALLEL_FALSE:
+        case PARALLEL_TRUE:
+            lua_pushboolean(L,tag == PARALLEL_TRUE);
+            break;
+        case PARALLEL_INTEGER:{
+            lua_Integer value;
+            memcpy(&value,p,sizeof(value));
+            p += sizeof(value);
+            lua_pushinteger(L,value);
+            break;
+        }
+        case PARALLEL_NUMBER:{
+            lua_Number value;
+            memcpy(&value,p,sizeof(value));
+            p += sizeof(value);
+            lua_pushnumber(L,value);
+            break;
+        }
+        case PARALLEL_STRING:{
+            size_t length;
+            memcpy(&length,p,sizeof(length));
+            p += sizeof(length);
+            lua_pushlstring(L,p,length);
+            p += length;
+            break;
+        }
+        case PARALLEL_TABLE:{
+            luaL_checkstack(L,3,"decode table");
+            lua_newtable(L);
+            while(*p != PARALLEL_END){
+                decodeValue(L,&p);
+                decodeValue(L,&p);
+                lua_rawset(L,-3);
+            }
+            p++;
+            break;
+        }
+    }
+    *cursor = p;
+}
+
+static uint64_t rangePack(uint32_t begin, uint32_t end){
+    return ((uint64_t) begin << 32) | end;
+}
+
+static int rangeTake(WorkRange *range, uint32_t *index){
+    uint64_t old = __atomic_load_n(&range->value,__ATOMIC_ACQUIRE);
+    for(;;){
+        uint32_t begin = (uint32_t)(old >> 32);
+        uint32_t end = (uint32_t) old;
+        if(begin >= end){
+            return 0;
+        }
+        if(__atomic_compare_exchange_n(&range->value,&old,rangePack(begin + 1,end),1,
+                                       __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+            *index = begin;
+            return 1;
+        }
+    }
+}
+
+//take the back half of the first non empty range, the own range is empty so nobody else writes it
+static int rangeSteal(Job *job, int self, uint32_t *index){
+    for(int i = 1; i < job->workerCount; i++){
+        WorkRange *victim = &job->ranges[(self + i) % job->workerCount];
+        uint64_t old = __atomic_load_n(&victim->value,__ATOMIC_ACQUIRE);
+        for(;;){
+            uint32_t begin = (uint32_t)(old >> 32);
+            uint32_t end = (uint32_t) old;
+            if(begin >= end){
+                break;
+            }
+            uint32_t middle = end - (end - begin + 1) / 2;
+            if(__atomic_compare_exchange_n(&victim->value,&old,rangePack(begin,middle),1,
+                                           __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+                __atomic_store_n(&job->ranges[self].value,rangePack(middle + 1,end),__ATOMIC_RELEASE);
+                *index = middle;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void jobFail(Job *job, const char *message){
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&job->failed,&expected,1,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+        snprintf(job->error,sizeof(job->error),"%s",message ? message : "parallel worker error");
+    }
+}
+
+//push the function of the job source, the chunk is loaded once per worker state and must return a function
+static int workerLoad(lua_State *L){
+    Job *job = (Job *) lua_touserdata(L,1);
+    if(lua_getfield(L,LUA_REGISTRYINDEX,PARALLEL_FUNCTIONS_KEY) != LUA_TTABLE){
+        lua_pop(L,1);
+        lua_newtable(L);
+        lua_pushvalue(L,-1);
+        lua_setfield(L,LUA_REGISTRYINDEX,PARALLEL_FUNCTIONS_KEY);
+    }
+    lua_pushlstring(L,job->source,job->sourceLength);
+    if(lua_rawget(L,-2) == LUA_TFUNCTION){
+        return 1;
+    }
+    lua_pop(L,1);
+    if(luaL_loadbuffer(L,job->source,job->sourceLength,"=parallel") != LUA_OK){
+        return lua_error(L);
+    }
+    lua_call(L,0,1);
+    if(!lua_isfunction(L,-1)){
+        return luaL_error(L,"parallel source must return a function");
+    }
+    lua_pushlstring(L,job->source,job->sourceLength);
+    lua_pushvalue(L,-2);
+    lua_rawset(L,-4);
+    return 1;
+}
+
+//fn(item, index), the result is encoded into the slot of the item
+static int workerCall(lua_State *L){
+    Job *job = (Job *) lua_touserdata(L,2);
+    uint32_t index = (uint32_t) lua_tointeger(L,3);
+    const char *cursor = job->input.data + job->offsets[index];
+    lua_pushvalue(L,1);
+    decodeValue(L,&cursor);
+    lua_pushinteger(L,(lua_Integer) index + 1);
+    lua_call(L,2,1);
+    Buffer buffer = {NULL,0,0};
+    const char *error = encodeValue(L,-1,&buffer,0);
+    if(error != NULL){
+        free(buffer.data);
+        return luaL_error(L,"result %d: %s",(int) index + 1,error);
+    }
+    job->results[index].data = buffer.data;
+    job->results[index].size = buffer.size;
+    return 0;
+}
+
+//created and injected on the calling thread, FindClass on a natively attached thread only sees the system classes
+static lua_State *workerState(Job *job, int id, JNIEnv *env){
+    lua_State *L = job->pool->states[id];
+    if(L == NULL){
+        L = luaL_newstate();
+        if(L == NULL){
+            return NULL;
+        }
+        luaL_openlibs(L);
+        luaJniInitLua(L,env);
+        luaJniInjectAll(L,env);
+        job->pool->states[id] = L;
+    }
+    return L;
+}
+
+static void *workerRun(void *arg){
+    Worker *worker = (Worker *) arg;
+    Job *job = worker->job;
+    JNIEnv *env = NULL;
+    if(ATTACH_THREAD(job->vm,&env) != JNI_OK){
+        jobFail(job,"can not attach the worker thread");
+        return NULL;
+    }
+    lua_State *L = job->pool->states[worker->id];
+    luaJniSetEnv(L,env);
+    lua_pushcfunction(L,workerLoad);
+    lua_pushlightuserdata(L,job);
+    if(lua_pcall(L,1,1,0) != LUA_OK){
+        jobFail(job,lua_tostring(L,-1));
+    }else{
+        uint32_t index;
+        while(!__atomic_load_n(&job->failed,__ATOMIC_ACQUIRE) &&
+              (rangeTake(&job->ranges[worker->id],&index) || rangeSteal(job,worker->id,&index))){
+            lua_pushcfunction(L,workerCall);
+            lua_pushvalue(L,1);
+            lua_pushlightuserdata(L,job);
+            lua_pushinteger(L,index);
+            if(lua_pcall(L,3,0,0) != LUA_OK){
+                jobFail(job,lua_tostring(L,-1));
+                break;
+            }
+        }
+    }
+    lua_settop(L,0);
+    (*job->vm)->DetachCurrentThread(job->vm);
+    return NULL;
+}
+
+static int poolGc(lua_State *L){
+    Pool *pool = (Pool *) lua_touserdata(L,1);
+    JNIEnv *env = luaJniGetEnv(L);
+    for(int i = 0; i < pool->count; i++){
+        if(pool->states[i]){
+            luaJniSetEnv(pool->states[i],env);
+            luaJniCloseLua(pool->states[i]);
+            pool->states[i] = NULL;
+        }
+    }
+    return 0;
+}
+
+static int jobGc(lua_State *L){
+    Job *job = (Job *) lua_touserdata(L,1);
+    if(job->results){
+        for(int i = 0; i < job->count; i++){
+            free(job->results[i].data);
+        }
+    }
+    free(job->results);
+    free(job->offsets);
+    free(job->ranges);
+    free(job->input.data);
+    job->results = NULL;
+    job->offsets = NULL;
+    job->ranges = NULL;
+    job->input.data = NULL;
+    return 0;
+}
+
+static Pool *getPool(lua_State *L){
+    if(lua_getfield(L,LUA_REGISTRYINDEX,PARALLEL_POOL_META_NAME) == LUA_TUSERDATA){
+        Pool *pool = (Pool *) lua_touserdata(L,-1);
+        lua_pop(L,1);
+        return pool;
+    }
+    lua_pop(L,1);
+    Pool *pool = (Pool *) lua_newuserdatauv(L,sizeof(Pool),0);
+    memset(pool,0,sizeof(Pool));
+    if(luaL_newmetatable(L,PARALLEL_POOL_META_NAME)){
+        lua_pushcfunction(L,poolGc);
+        lua_setfield(L,-2,"__gc");
+    }
+    lua_setmetatable(L,-2);
+    lua_setfield(L,LUA_REGISTRYINDEX,PARALLEL_POOL_META_NAME);
+    return pool;
+}
+
+static Job *newJob(lua_State *L){
+    Job *job = (Job *) lua_newuserdatauv(L,sizeof(Job),0);
+    memset(job,0,sizeof(Job));
+    if(luaL_newmetatable(L,PARALLEL_JOB_META_NAME)){
+        lua_pushcfunction(L,jobGc);
+        lua_setfield(L,-2,"__gc");
+    }
+    lua_setmetatable(L,-2);
+    return job;
+}
+
+int luaJniParallel(lua_State *L) {
+    size_t sourceLength;
+    const char *source = luaL_checklstring(L,1,&sourceLength);
+    luaL_checktype(L,2,LUA_TTABLE);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    lua_Integer workerCount = cores > 0 ? cores : 1;
+    if(!lua_isnoneornil(L,3)){
+        luaL_checktype(L,3,LUA_TTABLE);
+        if(lua_getfield(L,3,"workers") != LUA_TNIL){
+            workerCount = luaL_checkinteger(L,-1);
+        }
+        lua_pop(L,1);
+    }
+    lua_Integer count = luaL_len(L,2);
+    luaL_argcheck(L,count < INT32_MAX,2,"too many items");
+    if(workerCount > LUA_JNI_PARALLEL_MAX_WORKERS) workerCount = LUA_JNI_PARALLEL_MAX_WORKERS;
+    if(workerCount > count) workerCount = count;
+    if(workerCount < 1) workerCount = 1;
+    lua_settop(L,2);
+
+    Job *job = newJob(L);
+    JNIEnv *env = luaJniGetEnv(L);
+    (*env)->GetJavaVM(env,&job->vm);
+    job->pool = getPool(L);
+    job->source = source;
+    job->sourceLength = sourceLength;
+    job->count = (int) count;
+    job->workerCount = (int) workerCount;
+    job->offsets = (size_t *) malloc(sizeof(size_t) * (count + 1));
+    job->results = (Result *) calloc(count + 1,sizeof(Result));
+    job->ranges = (WorkRange *) calloc(workerCount,sizeof(WorkRange));
+    if(!job->offsets || !job->results || !job->ranges){
+        return luaL_error(L,"not enough memory");
+    }
+    for(int i = 0; i < count; i++){
+        job->offsets[i] = job->input.size;
+        lua_geti(L,2,i + 1);
+        const char *error = encodeValue(L,-1,&job->input,0);
+        if(error != NULL){
+            return luaL_error(L,"item %d: %s",i + 1,error);
+        }
+        lua_pop(L,1);
+    }
+    for(int i = 0; i < workerCount; i++){
+        job->ranges[i].value = rangePack((uint32_t)(count * i / workerCount),(uint32_t)(count * (i + 1) / workerCount));
+    }
+    for(int i = 0; i < workerCount; i++){
+        if(workerState(job,i,env) == NULL){
+            return luaL_error(L,"can not create the worker interpreter");
+        }
+        if(job->pool->count <= i){
+            job->pool->count = i + 1;
+        }
+    }
+    //a runaway item stops on the deadline or the cancel of the caller instead of blocking the join
+    for(int i = 0; i < workerCount; i++){
+        luaJniShareBudget(L,job->pool->states[i]);
+    }
+
+    pthread_t threads[LUA_JNI_PARALLEL_MAX_WORKERS];
+    Worker workers[LUA_JNI_PARALLEL_MAX_WORKERS];
+    int started = 0;
+    for(; started < workerCount; started++){
+        workers[started].job = job;
+        workers[started].id = started;
+        if(pthread_create(&threads[started],NULL,workerRun,&workers[started]) != 0){
+            //the running workers steal the ranges of the missing ones
+            break;
+        }
+    }
+    for(int i = 0; i < started; i++){
+        pthread_join(threads[i],NULL);
+    }
+    int reason = 0;
+    for(int i = 0; i < workerCount; i++){
+        luaJniSetEnv(job->pool->states[i],env);
+        int workerReason = luaJniUnshareBudget(job->pool->states[i]);
+        if(reason == 0) reason = workerReason;
+    }
+    if(started == 0){
+        return luaL_error(L,"can not start the parallel workers");
+    }
+    luaJniCheckBudget(L,reason);
+    LOGD("parallel %d items on %d workers \n",job->count,started);
+    if(job->failed){
+        return luaL_error(L,"%s",job->error);
+    }
+    lua_createtable(L,(int) count,0);
+    for(int i = 0; i < count; i++){
+        const char *cursor = job->results[i].data;
+        if(cursor){
+            decodeValue(L,&cursor);
+            lua_rawseti(L,-2,i + 1);
+        }
+    }
+    return 1;
+}
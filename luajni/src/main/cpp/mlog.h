@@ -4,7 +4,46 @@
 
 #ifndef AUTOLUA_MLOG_H
 #define AUTOLUA_MLOG_H
+
+#define LUA_JNI_LOG_TRACE 0
+#define LUA_JNI_LOG_DEBUG 1
+#define LUA_JNI_LOG_INFO 2
+#define LUA_JNI_LOG_WARN 3
+#define LUA_JNI_LOG_ERROR 4
+#define LUA_JNI_LOG_NONE 5
+
+//messages below LUA_JNI_LOG_MIN_LEVEL are compiled out, release builds keep info and above
+#ifndef LUA_JNI_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LUA_JNI_LOG_MIN_LEVEL LUA_JNI_LOG_INFO
+#else
+#define LUA_JNI_LOG_MIN_LEVEL LUA_JNI_LOG_TRACE
+#endif
+#endif
+
+//the compiled in messages are written from this level, see luaJniSetLogLevel
+extern int luaJniLogLevel;
+
+//define LUA_JNI_LOG_HEADER to a header providing LUA_JNI_LOG_WRITE(level,...) to plug in another logging backend
+#if defined(LUA_JNI_LOG_HEADER)
+#include LUA_JNI_LOG_HEADER
+#elif defined(__ANDROID__)
 #include <android/log.h>
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, "luajni", __VA_ARGS__)
+#define LUA_JNI_LOG_WRITE(level,...) __android_log_print(ANDROID_LOG_VERBOSE + (level), "luajni", __VA_ARGS__)
+#elif defined(LUA_JNI_LOG_STDERR)
+#include <stdio.h>
+#define LUA_JNI_LOG_WRITE(level,...) fprintf(stderr, __VA_ARGS__)
+#else
+#define LUA_JNI_LOG_WRITE(level,...) ((void)0)
+#endif
+
+#define LUA_JNI_LOG_ENABLED(level) ((level) >= LUA_JNI_LOG_MIN_LEVEL && (level) >= luaJniLogLevel)
+#define LUA_JNI_LOG(level,...) do{ if(LUA_JNI_LOG_ENABLED(level)) LUA_JNI_LOG_WRITE(level, __VA_ARGS__); }while(0)
+
+#define LOGT(...) LUA_JNI_LOG(LUA_JNI_LOG_TRACE, __VA_ARGS__)
+#define LOGD(...) LUA_JNI_LOG(LUA_JNI_LOG_DEBUG, __VA_ARGS__)
+#define LOGI(...) LUA_JNI_LOG(LUA_JNI_LOG_INFO, __VA_ARGS__)
+#define LOGW(...) LUA_JNI_LOG(LUA_JNI_LOG_WARN, __VA_ARGS__)
+#define LOGE(...) LUA_JNI_LOG(LUA_JNI_LOG_ERROR, __VA_ARGS__)
 
 #endif //AUTOLUA_MLOG_H
@@ -0,0 +1,13 @@
+package top.lizhistudio.luajni.core
+
+/**
+ * Thrown when a call is stopped by its [LuaBudget] or by [LuaInterpreter.cancel], the interpreter stays usable.
+ */
+class LuaAbortError(message: String, val reason: Int) : LuaError(message) {
+  companion object {
+    //LUA_JNI_ABORT_* in luajni.h
+    const val INSTRUCTIONS = 1
+    const val DEADLINE = 2
+    const val CANCELLED = 3
+  }
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+package top.lizhistudio.luajni.core
+
+/**
+ * Limits of one call into the interpreter, values <= 0 are unlimited. The instructions are counted in steps of
+ * at most LUA_JNI_BUDGET_CHECK_INTERVAL, the deadline is checked at the same points, time spent in java is not
+ * interrupted. Nested calls made by java bindings share the budget of the outermost call.
+ */
+class LuaBudget(
+  val maxInstructions: Long = 0,
+  val timeoutMillis: Long = 0
+) {
+  companion object {
+    @JvmField
+    val UNLIMITED = LuaBudget()
+  }
+}
@@ -0,0 +1,33 @@
+package top.lizhistudio.luajni.core
+
+import java.util.concurrent.atomic.AtomicBoolean
+
+/**
+ * Base class of the generated proxies which wrap a lua function as a java functional interface.
+ * The proxy must be invoked on the thread which owns the [LuaInterpreter], the one which created it or last called
+ * [LuaInterpreter.execute] or [LuaInterpreter.register], a call from any other thread throws [IllegalStateException].
+ * Post to the owning thread to invoke it from ui or worker threads.
+ * Passing the same lua function again returns the same proxy while it is alive and not closed.
+ */
+abstract class LuaCallback(@JvmField protected val nativePtr: Long) : AutoCloseable {
+  private val released = AtomicBoolean(false)
+
+  //the native callback is freed once released, calling it afterwards would touch freed memory
+  protected fun checkOpen() {
+    if (released.get()) throw IllegalStateException("LuaCallback has been closed.")
+  }
+
+  override fun close() {
+    if (released.compareAndSet(false, true)) {
+      release(nativePtr)
+    }
+  }
+
+  protected fun finalize() {
+    close()
+  }
+
+  companion object {
+    external fun release(nativePtr: Long)
+  }
+}
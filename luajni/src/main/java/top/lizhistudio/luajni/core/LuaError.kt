@@ -1,3 +1,3 @@
 package top.lizhistudio.luajni.core
 
-class LuaError(message:String): RuntimeException(message)
\ No newline at end of file
+open class LuaError @JvmOverloads constructor(message:String, cause:Throwable? = null): RuntimeException(message, cause)
\ No newline at end of file
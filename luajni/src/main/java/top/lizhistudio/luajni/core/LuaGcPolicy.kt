@@ -0,0 +1,15 @@
+package top.lizhistudio.luajni.core
+
+/**
+ * How the interpreter drives the lua collector for the java handles it creates, see [LuaInterpreter.setGcPolicy].
+ * Every new handle is charged [handleBytes] plus the size estimate of its class, once [stepBytes] are owed
+ * a collector step runs, or a full collection when more than [globalRefLimit] handles of this interpreter are alive.
+ * A full collection which leaves more than [globalRefLimit] handles alive is not repeated until a quarter of the
+ * limit more are alive, steps run meanwhile. [stepBytes] <= 0 leaves the collector alone.
+ */
+class LuaGcPolicy(
+  val handleBytes: Long = 512,
+  val stepBytes: Long = 256 * 1024,
+  val globalRefLimit: Long = 40_000,
+  val generational: Boolean = false
+)
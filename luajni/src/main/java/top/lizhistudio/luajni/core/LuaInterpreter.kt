@@ -1,11 +1,43 @@
 package top.lizhistudio.luajni.core
 
 class LuaInterpreter {
+  @Volatile
   private var nativePtr = create()
+  private var callBudget = LuaBudget.UNLIMITED
+  //cancel may come from any thread, destroy must not free the interpreter under it
+  private val lifetime = Any()
 
-  fun execute(script: String): Any? {
+  fun execute(script: String): Any? = execute(script, callBudget)
+
+  /**
+   * Run [script] within [budget], a [LuaAbortError] is thrown when it runs out.
+   */
+  fun execute(script: String, budget: LuaBudget): Any? {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    return execute(nativePtr, script, budget.maxInstructions, budget.timeoutMillis)
+  }
+
+  /**
+   * Budget of every call into the interpreter, used by [execute] without a budget and by the lua functions
+   * passed to java as callbacks.
+   */
+  fun setCallBudget(budget: LuaBudget) {
     if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
-    return execute(nativePtr, script)
+    callBudget = budget
+    setCallBudget(nativePtr, budget.maxInstructions, budget.timeoutMillis)
+  }
+
+  /**
+   * Abort the running call with a [LuaAbortError], it can be called from any thread. A call with a [LuaBudget]
+   * sees it within a thousand instructions, an unbudgeted call only at its next call into java, so pure lua
+   * loops need a budget to be cancellable. It only affects the call in flight, a cancel that arrives before
+   * [execute] starts is dropped.
+   */
+  fun cancel() {
+    synchronized(lifetime) {
+      val ptr = nativePtr
+      if (ptr != 0L) cancel(ptr)
+    }
   }
 
   fun register(vararg classes:Class<*>) = register(*classes.map { it.name }.toTypedArray())
@@ -19,20 +51,109 @@ class LuaInterpreter {
     return count
   }
 
+  /**
+   * Start sampling the scripts, lua stacks are sampled every [instructionInterval] instructions
+   * and one of every [bindingInterval] calls into java is timed and attributed to its member.
+   */
+  fun startProfiler(instructionInterval: Int = 100_000, bindingInterval: Int = 100) {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    startProfiler(nativePtr, instructionInterval, bindingInterval)
+  }
+
+  /**
+   * Stop the profiler and return the samples in collapsed stack format, one `frame;frame;java:Class.member nanoseconds`
+   * line per stack, which can be fed to flamegraph.pl or speedscope.
+   */
+  fun stopProfiler(): String {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    return stopProfiler(nativePtr)
+  }
+
+  /**
+   * Gauges of the native handles and the interpreter, plus the per-binding counters when they are compiled in.
+   */
+  fun stats(): LuaStats {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    val gauges = gauges(nativePtr)
+    val capacity = bindingStatsCount() + 16
+    val names = arrayOfNulls<String>(capacity * 2)
+    val values = LongArray(capacity * (STATS_BUCKETS + 1))
+    val count = bindingStats(names, values)
+    val bindings = List(count) { i ->
+      val offset = i * (STATS_BUCKETS + 1)
+      BindingStats(names[i * 2]!!, names[i * 2 + 1]!!, values[offset],
+        values.copyOfRange(offset + 1, offset + 1 + STATS_BUCKETS))
+    }
+    return LuaStats(gauges[0], gauges[1], gauges[2], gauges[3], gauges[4], gauges[5], bindings)
+  }
+
+  fun setGcPolicy(policy: LuaGcPolicy) {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    setGcPolicy(nativePtr, policy.handleBytes, policy.stepBytes, policy.globalRefLimit, policy.generational)
+  }
+
+  /**
+   * Charge [bytes] for every handle of the registered [clazz], for objects retaining much more memory than the handle.
+   * Return false if the class has not been registered.
+   */
+  fun setSizeEstimate(clazz: Class<*>, bytes: Long): Boolean {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    return setSizeEstimate(nativePtr, clazz.name, bytes)
+  }
+
+  /**
+   * Push java exceptions to lua as error objects instead of their message, `tostring(e)`, `e.message` and `e.stackTrace`
+   * are only formatted when a script reads them, an uncaught one is thrown as the cause of the [LuaError].
+   */
+  fun setLazyExceptions(lazy: Boolean) {
+    if (nativePtr == 0L) throw IllegalStateException("LuaInterpreter has been destroyed.")
+    setLazyExceptions(nativePtr, lazy)
+  }
+
+  /**
+   * Free the interpreter, it must not run concurrently with [execute] or a [LuaCallback] of this interpreter,
+   * proxies called afterwards throw [IllegalStateException].
+   */
   fun destroy() {
-    if(nativePtr != 0L){
-      destroy(nativePtr)
-      nativePtr = 0
+    synchronized(lifetime) {
+      if(nativePtr != 0L){
+        destroy(nativePtr)
+        nativePtr = 0
+      }
     }
   }
 
   companion object {
+    //LUA_JNI_STATS_BUCKETS in luajni.h
+    private const val STATS_BUCKETS = 32
+    //log levels of mlog.h
+    const val LOG_TRACE = 0
+    const val LOG_DEBUG = 1
+    const val LOG_INFO = 2
+    const val LOG_WARN = 3
+    const val LOG_ERROR = 4
+    const val LOG_NONE = 5
     init {
       System.loadLibrary("engine")
     }
     external fun create(): Long
     external fun register(nativePtr: Long, name: String):Boolean
     external fun destroy(nativePtr: Long)
-    external fun execute(nativePtr: Long, script: String):Any?
+    external fun execute(nativePtr: Long, script: String, maxInstructions: Long, timeoutMillis: Long):Any?
+    external fun startProfiler(nativePtr: Long, instructionInterval: Int, bindingInterval: Int)
+    external fun stopProfiler(nativePtr: Long):String
+    external fun gauges(nativePtr: Long):LongArray
+    external fun bindingStatsCount():Int
+    external fun bindingStats(names: Array<String?>, values: LongArray):Int
+    /**
+     * Native logging level of every interpreter, [LOG_WARN] by default.
+     * Release builds compile out the messages below [LOG_INFO], so lower levels only apply to debug builds.
+     */
+    external fun setLogLevel(level: Int)
+    external fun setGcPolicy(nativePtr: Long, handleBytes: Long, stepBytes: Long, globalRefLimit: Long, generational: Boolean)
+    external fun setSizeEstimate(nativePtr: Long, name: String, bytes: Long):Boolean
+    external fun setLazyExceptions(nativePtr: Long, lazy: Boolean)
+    external fun setCallBudget(nativePtr: Long, maxInstructions: Long, timeoutMillis: Long)
+    external fun cancel(nativePtr: Long)
   }
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+package top.lizhistudio.luajni.core
+
+/**
+ * Snapshot returned by [LuaInterpreter.stats]. Global references and handles are counted process wide,
+ * the heap, callbacks and frames belong to the interpreter.
+ */
+class LuaStats(
+  val globalRefs: Long,
+  val handlesCreated: Long,
+  val handlesCollected: Long,
+  val luaHeapBytes: Long,
+  val callbacks: Long,
+  val frameDepth: Long,
+  val bindings: List<BindingStats>
+) {
+  override fun toString(): String {
+    return "LuaStats(globalRefs=$globalRefs, handlesCreated=$handlesCreated, handlesCollected=$handlesCollected, " +
+            "luaHeapBytes=$luaHeapBytes, callbacks=$callbacks, frameDepth=$frameDepth, bindings=${bindings.size})"
+  }
+}
+
+/**
+ * Calls of one bound member, only recorded when the annotation processor runs with `luajni.stats=true`.
+ * [histogram] bucket i counts the calls which took [2^i, 2^(i+1)) nanoseconds.
+ */
+class BindingStats(
+  val className: String,
+  val member: String,
+  val calls: Long,
+  val histogram: LongArray
+) {
+  /**
+   * Upper bound in nanoseconds of the bucket holding the given percentile, 0 if nothing was recorded.
+   */
+  fun percentileNanos(percentile: Double): Long {
+    val total = histogram.sum()
+    if (total == 0L) return 0
+    val target = Math.ceil(total * percentile / 100).toLong().coerceAtLeast(1)
+    var count = 0L
+    histogram.forEachIndexed { index, value ->
+      count += value
+      if (count >= target) return 1L shl (index + 1)
+    }
+    return 1L shl histogram.size
+  }
+
+  override fun toString(): String {
+    return "$className.$member calls=$calls p50=${percentileNanos(50.0)}ns p99=${percentileNanos(99.0)}ns"
+  }
+}
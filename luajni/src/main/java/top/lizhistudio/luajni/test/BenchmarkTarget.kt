@@ -0,0 +1,74 @@
+package top.lizhistudio.luajni.test
+
+import top.lizhistudio.annotation.LuaClass
+import top.lizhistudio.annotation.LuaField
+
+@LuaClass(autoRegister = true)
+class BenchmarkTarget {
+  @LuaField
+  var intValue = 0
+  @LuaField
+  var text: String? = ""
+  @LuaField
+  var boxed: Int? = 0
+  @LuaField
+  val ints = IntArray(1024) { it }
+  @LuaField
+  val matrix = Array(64) { i -> IntArray(64) { j -> i * 64 + j } }
+
+  @LuaField
+  fun call0(): Int = 0
+
+  @LuaField
+  fun call1(a: Int): Int = a
+
+  @LuaField
+  fun call3(a: Int, b: Int, c: Int): Int = a + b + c
+
+  @LuaField
+  fun call5(a: Int, b: Int, c: Int, d: Int, e: Int): Int = a + b + c + d + e
+
+  @LuaField
+  fun overload(a: Int): Int = a
+
+  @LuaField
+  fun overload(a: Double): Double = a
+
+  @LuaField
+  fun overload(a: String?): String? = a
+
+  @LuaField
+  fun overload(a: Int, b: Int): Int = a + b
+
+  @LuaField
+  fun box(a: Int?): Int? = a
+
+  @LuaField
+  fun echo(s: String?): String? = s
+
+  @LuaField
+  fun newObject(): BenchmarkTarget = BenchmarkTarget()
+}
+
+@LuaClass(autoRegister = true, compact = true)
+class CompactBenchmarkTarget {
+  @LuaField
+  var intValue = 0
+  @LuaField
+  var text: String? = ""
+
+  @LuaField
+  fun call0(): Int = 0
+
+  @LuaField
+  fun call1(a: Int): Int = a
+
+  @LuaField
+  fun call3(a: Int, b: Int, c: Int): Int = a + b + c
+
+  @LuaField
+  fun call5(a: Int, b: Int, c: Int, d: Int, e: Int): Int = a + b + c + d + e
+
+  @LuaField
+  fun echo(s: String?): String? = s
+}
@@ -0,0 +1,71 @@
+package top.lizhistudio.luajni.test
+
+import top.lizhistudio.annotation.LuaClass
+import top.lizhistudio.annotation.LuaField
+
+@LuaClass(autoRegister = true)
+class CallbackTest {
+  @LuaField
+  fun run(runnable: Runnable) {
+    runnable.run()
+  }
+
+  @LuaField
+  fun map(value: Int, transform: (Int) -> Int): Int {
+    return transform(value)
+  }
+
+  @LuaField
+  fun listen(listener: (String) -> Unit) {
+    listener("Hello")
+  }
+
+  private var kept: Runnable? = null
+
+  @LuaField
+  fun same(a: Runnable, b: Runnable): Boolean {
+    return a === b
+  }
+
+  @LuaField
+  fun keep(runnable: Runnable) {
+    kept = runnable
+  }
+
+  @LuaField
+  fun runKept() {
+    kept?.run()
+  }
+
+  //the proxy must refuse a call from a thread which does not own the interpreter
+  @LuaField
+  fun runKeptElsewhere(): Boolean {
+    val runnable = kept ?: return false
+    var refused = false
+    val thread = Thread {
+      refused = try {
+        runnable.run()
+        false
+      } catch (e: IllegalStateException) {
+        true
+      }
+    }
+    thread.start()
+    thread.join()
+    return refused
+  }
+
+  //a closed proxy must refuse the call instead of entering the freed callback
+  @LuaField
+  fun closeKept(): Boolean {
+    val runnable = kept ?: return false
+    kept = null
+    (runnable as AutoCloseable).close()
+    return try {
+      runnable.run()
+      false
+    } catch (e: IllegalStateException) {
+      true
+    }
+  }
+}
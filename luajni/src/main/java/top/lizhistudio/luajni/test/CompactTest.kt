@@ -0,0 +1,37 @@
+package top.lizhistudio.luajni.test
+
+import top.lizhistudio.annotation.LuaClass
+import top.lizhistudio.annotation.LuaField
+
+@LuaClass(autoRegister = true, compact = true)
+class CompactTest {
+  @LuaField
+  var oneValue = 1
+  @LuaField
+  var name = "compact"
+
+  @LuaField
+  fun add(value: Int): Int {
+    return oneValue + value
+  }
+
+  @LuaField
+  fun add(value: Double): Double {
+    return oneValue + value
+  }
+
+  @LuaField
+  fun concat(value: String?, count: Int?): String {
+    return "$name$value${count ?: 0}"
+  }
+
+  @LuaField
+  fun map(value: Int, transform: (Int) -> Int): Int {
+    return transform(value)
+  }
+
+  @LuaField(unpack = ["oneValue", "name"])
+  fun pair(present: Boolean): CompactTest? {
+    return if (present) this else null
+  }
+}
@@ -0,0 +1,26 @@
+package top.lizhistudio.luajni.test
+
+import top.lizhistudio.annotation.LuaClass
+import top.lizhistudio.annotation.LuaField
+
+@LuaClass(autoRegister = true)
+class ConstantTest {
+  @LuaField(readonly = true, cached = true)
+  val name = "config"
+
+  @LuaField(method2field = true, cached = true)
+  fun config(): String {
+    reads++
+    return "config-$reads"
+  }
+
+  companion object {
+    @LuaField
+    const val VERSION = 3
+    @LuaField
+    const val TITLE = "say \"hi\"??"
+    @LuaField
+    const val RATIO = 0.5
+    var reads = 0
+  }
+}
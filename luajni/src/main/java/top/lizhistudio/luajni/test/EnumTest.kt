@@ -0,0 +1,33 @@
+package top.lizhistudio.luajni.test
+
+import top.lizhistudio.annotation.LuaClass
+import top.lizhistudio.annotation.LuaEnum
+import top.lizhistudio.annotation.LuaField
+
+@LuaEnum
+enum class TrafficLight {
+  RED, YELLOW, GREEN
+}
+
+@LuaClass
+class Crossing @LuaField constructor() {
+  @LuaField
+  var light: TrafficLight = TrafficLight.RED
+
+  @LuaField
+  fun next(light: TrafficLight): TrafficLight {
+    return TrafficLight.values()[(light.ordinal + 1) % TrafficLight.values().size]
+  }
+
+  @LuaField
+  fun isStop(light: TrafficLight?): Boolean {
+    return light == null || light == TrafficLight.RED
+  }
+
+  @LuaField(unpack = ["light", "seconds"])
+  fun phase(): Phase {
+    return Phase(light, if (light == TrafficLight.YELLOW) 3 else 30)
+  }
+}
+
+data class Phase(val light: TrafficLight, val seconds: Int)
@@ -0,0 +1,33 @@
+package top.lizhistudio.luajni.test
+
+import top.lizhistudio.annotation.LuaClass
+import top.lizhistudio.annotation.LuaField
+
+@LuaClass
+class NameList @LuaField constructor() : ArrayList<String>() {
+  @LuaField
+  fun put(name: String) {
+    add(name)
+  }
+}
+
+@LuaClass
+class Countdown @LuaField constructor(private val from: Int) : Iterable<Int> {
+  override fun iterator(): Iterator<Int> = (from downTo 1).iterator()
+}
+
+@LuaClass
+class BrokenList @LuaField constructor() : AbstractList<String>(), RandomAccess {
+  override val size: Int
+    get() = throw IllegalStateException("broken size")
+
+  override fun get(index: Int): String = "n$index"
+}
+
+@LuaClass
+class BrokenBag @LuaField constructor() : AbstractCollection<String>() {
+  override val size: Int
+    get() = throw IllegalStateException("broken size")
+
+  override fun iterator(): Iterator<String> = throw IllegalStateException("broken iterator")
+}
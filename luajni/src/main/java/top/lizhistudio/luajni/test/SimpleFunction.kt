@@ -11,8 +11,18 @@ object SimpleFunction {
   fun sub(a: Int, b: Int): Int {
     return a - b
   }
+  @LuaFunction
+  fun find(key: String): String {
+    throw NoSuchElementException(key)
+  }
+  @LuaFunction(unpack = ["x", "y", "w", "h"])
+  fun bounds(size: Int): Bounds? {
+    return if (size > 0) Bounds(size, size * 2, size * 3, size * 4) else null
+  }
 }
 
+data class Bounds(val x: Int, val y: Int, val w: Int, val h: Int)
+
 @LuaFunction
 fun testName(n:String):String{
   return "Hello $n"
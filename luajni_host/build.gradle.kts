@@ -0,0 +1,69 @@
+plugins {
+  id("java-library")
+  alias(libs.plugins.jetbrains.kotlin.jvm)
+  alias(libs.plugins.kotlin.kapt)
+}
+
+//Runs the binding stack on the desktop jdk, the native engine is built with the host toolchain
+java {
+  sourceCompatibility = JavaVersion.VERSION_17
+  targetCompatibility = JavaVersion.VERSION_17
+}
+
+sourceSets {
+  main {
+    java.srcDir("../luajni/src/main/java")
+  }
+  create("benchmark") {
+    compileClasspath += sourceSets["main"].output + sourceSets["main"].compileClasspath
+    runtimeClasspath += output + compileClasspath
+  }
+}
+
+kapt {
+  arguments {
+    arg("luajni.stats", (findProperty("luajni.stats") as String?) ?: "false")
+  }
+}
+
+val nativeSourceDir = file("../luajni/src/main/cpp")
+val nativeBuildDir = layout.buildDirectory.dir("native")
+val extensionDir = layout.buildDirectory.dir("generated/source/kapt/main/cpp")
+val nativeBuildType = (findProperty("luajni.host.buildType") as String?) ?: "RelWithDebInfo"
+
+val configureNative by tasks.registering(Exec::class) {
+  dependsOn("kaptKotlin")
+  commandLine("cmake",
+    "-S", nativeSourceDir.absolutePath,
+    "-B", nativeBuildDir.get().asFile.absolutePath,
+    "-DCMAKE_BUILD_TYPE=$nativeBuildType",
+    "-DCMAKE_C_FLAGS=-DLUA_JNI_LOG_STDERR",
+    "-DLUA_JNI_EXTENSION_DIR=${extensionDir.get().asFile.absolutePath}")
+}
+
+val buildNative by tasks.registering(Exec::class) {
+  dependsOn(configureNative)
+  commandLine("cmake", "--build", nativeBuildDir.get().asFile.absolutePath, "--parallel")
+}
+
+tasks.test {
+  dependsOn(buildNative)
+  systemProperty("java.library.path", nativeBuildDir.get().asFile.absolutePath)
+}
+
+//Writes build/benchmark/results.json, -Pluajni.benchmark.filter=<regex> runs a subset of the cases
+tasks.register<JavaExec>("benchmark") {
+  dependsOn(buildNative)
+  group = "verification"
+  classpath = sourceSets["benchmark"].runtimeClasspath
+  mainClass.set("top.lizhistudio.luajni.benchmark.LuaBenchmark")
+  systemProperty("java.library.path", nativeBuildDir.get().asFile.absolutePath)
+  args(layout.buildDirectory.file("benchmark/results.json").get().asFile.absolutePath)
+  (findProperty("luajni.benchmark.filter") as String?)?.let { args(it) }
+}
+
+dependencies {
+  implementation(project(":annotation"))
+  kapt(project(":annotation_processor"))
+  testImplementation(libs.junit)
+}
@@ -0,0 +1,166 @@
+package top.lizhistudio.luajni.benchmark
+
+import top.lizhistudio.luajni.core.LuaInterpreter
+import top.lizhistudio.luajni.test.BenchmarkTarget
+import top.lizhistudio.luajni.test.CallbackTest
+import top.lizhistudio.luajni.test.CompactBenchmarkTarget
+import top.lizhistudio.luajni.test.CompactTest
+import top.lizhistudio.luajni.test.ConstantTest
+import top.lizhistudio.luajni.test.SimpleTest
+import top.lizhistudio.luajni.test.WrapperTest
+import java.io.File
+import java.util.Locale
+
+/**
+ * Times the binding hot paths and writes the results as json, run with `gradlew :luajni_host:benchmark`.
+ * The loops run inside lua so the numbers are the cost of one binding call, not of a jni round-trip from kotlin.
+ */
+object LuaBenchmark {
+  private const val ROUNDS = 5
+  private const val ITERATIONS = 200_000
+  private const val EXECUTE_ITERATIONS = 5_000
+  private const val CREATE_ITERATIONS = 200
+
+  private val classes = listOf(
+    BenchmarkTarget::class.java,
+    CompactBenchmarkTarget::class.java,
+    SimpleTest::class.java,
+    WrapperTest::class.java,
+    CallbackTest::class.java,
+    CompactTest::class.java,
+    ConstantTest::class.java)
+
+  class Result(val name: String, val iterations: Int, val samples: List<Long>) {
+    val nsPerOp get() = samples.sorted()[samples.size / 2].toDouble() / iterations
+    val minNsPerOp get() = samples.min().toDouble() / iterations
+  }
+
+  @JvmStatic
+  fun main(args: Array<String>) {
+    val output = File(args.getOrElse(0) { "build/benchmark/results.json" })
+    val filter = args.getOrNull(1)?.let { Regex(it) }
+    val results = mutableListOf<Result>()
+    val lua = LuaInterpreter()
+    lua.register(BenchmarkTarget::class.java, CompactBenchmarkTarget::class.java)
+    lua.execute("""
+      target = BenchmarkTarget
+      compact = CompactBenchmarkTarget
+      array = target.ints
+    """.trimIndent())
+    for ((name, setup, body) in loopCases()) {
+      if (filter != null && !filter.containsMatchIn(name)) continue
+      results.add(measureLoop(lua, name, setup, body))
+    }
+    if (filter == null || filter.containsMatchIn("execute.same")) {
+      results.add(measure("execute.same", EXECUTE_ITERATIONS) { lua.execute("return 1") })
+    }
+    if (filter == null || filter.containsMatchIn("execute.distinct")) {
+      val scripts = Array(EXECUTE_ITERATIONS) { "return $it" }
+      results.add(measure("execute.distinct", EXECUTE_ITERATIONS) { i -> lua.execute(scripts[i]) })
+    }
+    lua.destroy()
+    for (count in listOf(0, 1, classes.size)) {
+      val name = "create.classes.$count"
+      if (filter != null && !filter.containsMatchIn(name)) continue
+      val registered = classes.take(count).toTypedArray()
+      results.add(measure(name, CREATE_ITERATIONS) {
+        val interpreter = LuaInterpreter()
+        interpreter.register(*registered)
+        interpreter.destroy()
+      })
+    }
+    output.parentFile?.mkdirs()
+    output.writeText(toJson(results))
+    results.forEach { println(String.format("%-32s %12.1f ns/op", it.name, it.nsPerOp)) }
+    println("results written to ${output.absolutePath}")
+  }
+
+  private fun loopCases(): List<Triple<String, String, String>> {
+    val cases = mutableListOf(
+      Triple("loop.empty", "", ""),
+      Triple("field.get", "", "local v = t.intValue"),
+      Triple("field.set", "", "t.intValue = i"),
+      Triple("field.get.compact", "t = compact", "local v = t.intValue"),
+      Triple("field.set.compact", "t = compact", "t.intValue = i"),
+      Triple("method.arity0", "", "t:call0()"),
+      Triple("method.arity1", "", "t:call1(i)"),
+      Triple("method.arity3", "", "t:call3(i, i, i)"),
+      Triple("method.arity5", "", "t:call5(i, i, i, i, i)"),
+      Triple("method.arity0.compact", "t = compact", "t:call0()"),
+      Triple("method.arity1.compact", "t = compact", "t:call1(i)"),
+      Triple("method.arity3.compact", "t = compact", "t:call3(i, i, i)"),
+      Triple("method.arity5.compact", "t = compact", "t:call5(i, i, i, i, i)"),
+      Triple("method.overload4.first", "", "t:overload(i)"),
+      Triple("method.overload4.second", "local d = 0.5", "t:overload(d)"),
+      Triple("method.overload4.third", "local s = 'a'", "t:overload(s)"),
+      Triple("method.overload4.fourth", "", "t:overload(i, i)"),
+      Triple("object.return", "", "local o = t:newObject()"),
+      Triple("object.return.gc", "", "local o = t:newObject() if i % 1000 == 0 then collectgarbage() end"),
+      Triple("wrapper.call", "", "t:box(i)"),
+      Triple("wrapper.field.get", "", "local v = t.boxed"),
+      Triple("wrapper.field.set", "", "t.boxed = i"),
+      Triple("array.element.get", "local a = array", "local v = a[i % 1024 + 1]"),
+      Triple("array.element.set", "local a = array", "a[i % 1024 + 1] = i"),
+      Triple("array.length", "local a = array", "local v = #a"),
+      Triple("matrix.index", "local m = t.matrix", "local v = m[i % 64 + 1][i % 63 + 1]"),
+      Triple("matrix.get", "local m = t.matrix", "local v = m:get(i % 64 + 1, i % 63 + 1)"),
+      Triple("matrix.set", "local m = t.matrix", "m:set(i % 64 + 1, i % 63 + 1, i)"))
+    for (length in listOf(16, 1024, 65536)) {
+      val setup = "local s = string.rep('a', $length)"
+      cases.add(Triple("string.in.$length", setup, "t.text = s"))
+      cases.add(Triple("string.out.$length", "$setup t.text = s", "local v = t.text"))
+      cases.add(Triple("string.echo.$length", setup, "local v = t:echo(s)"))
+      cases.add(Triple("string.in.$length.compact", "t = compact $setup", "t.text = s"))
+      cases.add(Triple("string.out.$length.compact", "t = compact $setup t.text = s", "local v = t.text"))
+    }
+    return cases
+  }
+
+  private fun measureLoop(lua: LuaInterpreter, name: String, setup: String, body: String): Result {
+    val iterations = if (name.startsWith("string.") && name.contains("65536")) ITERATIONS / 100 else ITERATIONS
+    val script = """
+      local t = target
+      $setup
+      for i = 1, $iterations do
+        $body
+      end
+      collectgarbage()
+    """.trimIndent()
+    lua.execute(script)
+    val samples = List(ROUNDS) {
+      val start = System.nanoTime()
+      lua.execute(script)
+      System.nanoTime() - start
+    }
+    return Result(name, iterations, samples)
+  }
+
+  private fun measure(name: String, iterations: Int, block: (Int) -> Unit): Result {
+    for (i in 0 until iterations) block(i)
+    val samples = List(ROUNDS) {
+      val start = System.nanoTime()
+      for (i in 0 until iterations) block(i)
+      System.nanoTime() - start
+    }
+    return Result(name, iterations, samples)
+  }
+
+  private fun toJson(results: List<Result>): String {
+    val entries = results.joinToString(",\n") {
+      "    {\"name\": \"${it.name}\", \"iterations\": ${it.iterations}, " +
+              "\"nsPerOp\": ${String.format(Locale.ROOT, "%.2f", it.nsPerOp)}, \"minNsPerOp\": ${String.format(Locale.ROOT, "%.2f", it.minNsPerOp)}, " +
+              "\"samplesNs\": [${it.samples.joinToString(", ")}]}"
+    }
+    return """
+      |{
+      |  "timestamp": ${System.currentTimeMillis()},
+      |  "os": "${System.getProperty("os.name")} ${System.getProperty("os.arch")}",
+      |  "java": "${System.getProperty("java.version")}",
+      |  "rounds": $ROUNDS,
+      |  "results": [
+      |$entries
+      |  ]
+      |}
+      |""".trimMargin()
+  }
+}
@@ -0,0 +1,44 @@
+package top.lizhistudio.luajni
+
+import org.junit.Assert.*
+import org.junit.Test
+import top.lizhistudio.luajni.core.LuaError
+import top.lizhistudio.luajni.core.LuaInterpreter
+import top.lizhistudio.luajni.test.CallbackTest
+import top.lizhistudio.luajni.test.CompactTest
+import top.lizhistudio.luajni.test.SimpleTest
+
+/**
+ * Runs the native engine built by the host toolchain, see luajni_host/build.gradle.kts.
+ */
+class LuaHostTest {
+  @Test
+  fun testExecute() {
+    val lua = LuaInterpreter()
+    assertEquals(2L, lua.execute("return 1 + 1"))
+    try {
+      lua.execute("return 1 +")
+      fail("Should throw exception")
+    } catch (e: Exception) {
+      assertTrue(e is LuaError)
+    }
+    lua.destroy()
+  }
+
+  @Test
+  fun testBinding() {
+    val lua = LuaInterpreter()
+    lua.register(
+      SimpleTest::class.java,
+      CompactTest::class.java,
+      CallbackTest::class.java)
+    val code = """
+      SimpleTest:setValue(3, 4)
+      assert(SimpleTest:add() == 7)
+      assert(CompactTest:add(2) == 3)
+      assert(CallbackTest:map(2, function(v) return v * 10 end) == 20)
+    """.trimIndent()
+    lua.execute(code)
+    lua.destroy()
+  }
+}
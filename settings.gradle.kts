@@ -24,3 +24,4 @@ include(":app")
 include(":annotation")
 include(":annotation_processor")
 include(":luajni")
+include(":luajni_host")